@@ -21,6 +21,8 @@
 #include "riscv.h"
 #include "defs.h"
 #include "proc.h"
+#include "waitq.h"
+#include "poll.h"
 
 #define BACKSPACE 0x100  // erase the last output character
 #define C(x)  ((x)-'@')  // Control-x
@@ -51,6 +53,8 @@ struct {
   uint r;  // Read index
   uint w;  // Write index
   uint e;  // Edit index
+
+  struct waitq wq;  // poll()s waiting for input
 } cons;
 
 //
@@ -80,10 +84,11 @@ consolewrite(int user_src, uint64 src, int n)
 // user read()s from the console go here.
 // copy (up to) a whole input line to dst.
 // user_dst indicates whether dst is a user
-// or kernel address.
+// or kernel address. if nonblock, fail
+// rather than wait for a line to arrive.
 //
 int
-consoleread(int user_dst, uint64 dst, int n)
+consoleread(int user_dst, uint64 dst, int n, int nonblock)
 {
   uint target;
   int c;
@@ -95,6 +100,10 @@ consoleread(int user_dst, uint64 dst, int n)
     // wait until interrupt handler has put some
     // input into cons.buffer.
     while(cons.r == cons.w){
+      if(nonblock){
+        release(&cons.lock);
+        return n < target ? target - n : -1;
+      }
       if(killed(myproc())){
         release(&cons.lock);
         return -1;
@@ -176,6 +185,7 @@ consoleintr(int c)
         // has arrived.
         cons.w = cons.e;
         wakeup(&cons.r);
+        waitqwake(&cons.wq);
       }
     }
     break;
@@ -184,6 +194,20 @@ consoleintr(int c)
   release(&cons.lock);
 }
 
+// POLLIN once a line has arrived. output never waits long.
+static int
+consolepoll(struct pollwait *w)
+{
+  int mask = POLLOUT;
+
+  acquire(&cons.lock);
+  pollwait(&cons.wq, w);
+  if(cons.r != cons.w)
+    mask |= POLLIN;
+  release(&cons.lock);
+  return mask;
+}
+
 void
 consoleinit(void)
 {
@@ -195,4 +219,5 @@ consoleinit(void)
   // to consoleread and consolewrite.
   devsw[CONSOLE].read = consoleread;
   devsw[CONSOLE].write = consolewrite;
+  devsw[CONSOLE].poll = consolepoll;
 }
@@ -8,6 +8,13 @@ struct spinlock;
 struct sleeplock;
 struct stat;
 struct superblock;
+struct memstat;
+struct objcache;
+struct pollwait;
+struct waitq;
+struct utime;
+struct vma;
+struct shmseg;
 
 // bio.c
 void            binit(void);
@@ -33,6 +40,8 @@ void            fileinit(void);
 int             fileread(struct file*, uint64, int n);
 int             filestat(struct file*, uint64 addr);
 int             filewrite(struct file*, uint64, int n);
+int             filesplice(struct file*, struct file*, int);
+int             filepoll(struct file*, struct pollwait*);
 
 // fs.c
 void            fsinit(int);
@@ -59,6 +68,14 @@ void            ireclaim(int);
 void*           kalloc(void);
 void            kfree(void *);
 void            kinit(void);
+void*           kzalloc(void);
+void            krefpage(void *);
+int             krefcount(void *);
+void            kzero_idle(void);
+void*           kalloc_order(int);
+void            kfree_order(void *, int);
+void            ksplit(void *, int);
+void            kmemstat(struct memstat*);
 
 // log.c
 void            initlog(int, struct superblock*);
@@ -67,10 +84,27 @@ void            begin_op(void);
 void            end_op(void);
 
 // pipe.c
+void            pipeinit(void);
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
-int             piperead(struct pipe*, uint64, int);
-int             pipewrite(struct pipe*, uint64, int);
+int             piperead(struct pipe*, int, uint64, int, int);
+int             pipewrite(struct pipe*, int, uint64, int, int);
+int             pipespace(struct pipe*, int);
+int             pipepeek(struct pipe*, char*, int, int);
+void            pipeconsume(struct pipe*, int);
+int             pipegetsize(struct pipe*);
+int             pipesetsize(struct pipe*, int);
+int             pipepoll(struct pipe*, int, struct pollwait*);
+
+// ring.c
+uint64          ringsetup(struct proc*);
+int             ringenter(struct proc*, int);
+
+// poll.c
+void            pollinit(void);
+void            pollwait(struct waitq*, struct pollwait*);
+void            waitqwake(struct waitq*);
+int             kpoll(uint64, int, int);
 
 // printf.c
 int             printf(char*, ...) __attribute__ ((format (printf, 1, 2)));
@@ -101,6 +135,9 @@ void            yield(void);
 int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
 void            procdump(void);
+void            pi_releaseall(struct proc*);
+int             pi_acquire(struct proc*, int);
+int             pi_release(struct proc*, int);
 
 // swtch.S
 void            swtch(struct context*, struct context*);
@@ -113,6 +150,22 @@ void            release(struct spinlock*);
 void            push_off(void);
 void            pop_off(void);
 
+// shm.c
+void            shminit(void);
+int             shmget(int, uint64);
+uint64          shmattach(struct proc*, int);
+int             shmdetach(struct proc*, uint64);
+char*           shmpage(struct shmseg*, uint);
+void            shmdup(struct shmseg*);
+void            shmput(struct shmseg*);
+int             shmremove(int);
+void            shmexit(struct proc*);
+
+// slab.c
+void            objcache_init(struct objcache*, char*, uint, void (*)(void*));
+void*           objalloc(struct objcache*);
+void            objfree(struct objcache*, void*);
+
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
@@ -137,7 +190,11 @@ int             fetchaddr(uint64, uint64*);
 void            syscall();
 
 // trap.c
-extern uint     ticks;
+extern uint64   ticks;
+extern int      tickwaiters;
+extern struct waitq tickq;
+uint64          readticks(void);
+extern struct utime *utime;
 void            trapinit(void);
 void            trapinithart(void);
 extern struct spinlock tickslock;
@@ -169,6 +226,22 @@ int             copyin(pagetable_t, char *, uint64, uint64);
 int             copyinstr(pagetable_t, char *, uint64, uint64);
 int             ismapped(pagetable_t, uint64);
 uint64          vmfault(pagetable_t, uint64, int);
+uint64          cowfault(pagetable_t, uint64);
+int             uvmshare(pagetable_t, pagetable_t, uint64, uint64, int);
+void            rssadd(pagetable_t, int);
+int             rssok(pagetable_t, int);
+
+// vma.c
+struct vma*     vmalookup(struct proc*, uint64);
+uint64          vmafault(pagetable_t, struct vma*, uint64);
+int             vmprefault(struct proc*, uint64, uint64);
+void            vmapopulate(struct proc*);
+int             vmafork(struct proc*, struct proc*);
+void            vmatrim(struct proc*, uint64, uint64);
+uint64          vmalimit(struct proc*);
+void            vmarelease(pagetable_t, struct vma*);
+uint64          vmamap(struct proc*, uint64, int, int, struct inode*, uint);
+int             vmaunmap(struct proc*, uint64, uint64);
 
 // plic.c
 void            plicinit(void);
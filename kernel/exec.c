@@ -6,8 +6,7 @@
 #include "proc.h"
 #include "defs.h"
 #include "elf.h"
-
-static int loadseg(pde_t *, uint64, struct inode *, uint, uint);
+#include "mman.h"
 
 // map ELF permissions to PTE permission bits.
 int flags2perm(int flags)
@@ -27,14 +26,16 @@ int
 kexec(char *path, char **argv)
 {
   char *s, *last;
-  int i, off;
+  int i, off, nvma = 0;
   uint64 argc, sz = 0, sp, ustack[MAXARG], stackbase;
   struct elfhdr elf;
   struct inode *ip;
   struct proghdr ph;
+  struct vma vma[NVMA];
   pagetable_t pagetable = 0, oldpagetable;
   struct proc *p = myproc();
 
+  memset(vma, 0, sizeof(vma));
   begin_op();
 
   // Open the executable file.
@@ -55,7 +56,8 @@ kexec(char *path, char **argv)
   if((pagetable = proc_pagetable(p)) == 0)
     goto bad;
 
-  // Load program into memory.
+  // Map the program's segments. Nothing is read yet:
+  // vmfault() reads each page from ip on first touch.
   for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
     if(readi(ip, 0, (uint64)&ph, off, sizeof(ph)) != sizeof(ph))
       goto bad;
@@ -67,12 +69,22 @@ kexec(char *path, char **argv)
       goto bad;
     if(ph.vaddr % PGSIZE != 0)
       goto bad;
-    uint64 sz1;
-    if((sz1 = uvmalloc(pagetable, sz, ph.vaddr + ph.memsz, flags2perm(ph.flags))) == 0)
+    if(ph.vaddr < sz || ph.vaddr + ph.memsz > USERTOP)
+      goto bad;
+    if(ph.off + ph.filesz < ph.off)
       goto bad;
-    sz = sz1;
-    if(loadseg(pagetable, ph.vaddr, ip, ph.off, ph.filesz) < 0)
+    if(nvma >= NVMA)
       goto bad;
+    vma[nvma].used = 1;
+    vma[nvma].start = ph.vaddr;
+    vma[nvma].end = ph.vaddr + ph.memsz;
+    vma[nvma].perm = flags2perm(ph.flags);
+    vma[nvma].flags = MAP_PRIVATE;
+    vma[nvma].ip = idup(ip);
+    vma[nvma].off = ph.off;
+    vma[nvma].filesz = ph.filesz;
+    nvma++;
+    sz = ph.vaddr + ph.memsz;
   }
   iunlockput(ip);
   end_op();
@@ -131,8 +143,12 @@ kexec(char *path, char **argv)
   oldpagetable = p->pagetable;
   p->pagetable = pagetable;
   p->sz = sz;
+  p->rss = USERSTACK+1;  // vmfault() brings in the rest
+  p->ring = 0;           // unmapped with the old vmas
   p->trapframe->epc = elf.entry;  // initial program counter = ulib.c:start()
   p->trapframe->sp = sp; // initial stack pointer
+  vmarelease(oldpagetable, p->vma);
+  memmove(p->vma, vma, sizeof(vma));
   proc_freepagetable(oldpagetable, oldsz);
 
   return argc; // this ends up in a0, the first argument to main(argc, argv)
@@ -144,30 +160,6 @@ kexec(char *path, char **argv)
     iunlockput(ip);
     end_op();
   }
+  vmarelease(0, vma);
   return -1;
 }
-
-// Load an ELF program segment into pagetable at virtual address va.
-// va must be page-aligned
-// and the pages from va to va+sz must already be mapped.
-// Returns 0 on success, -1 on failure.
-static int
-loadseg(pagetable_t pagetable, uint64 va, struct inode *ip, uint offset, uint sz)
-{
-  uint i, n;
-  uint64 pa;
-
-  for(i = 0; i < sz; i += PGSIZE){
-    pa = walkaddr(pagetable, va + i);
-    if(pa == 0)
-      panic("loadseg: address should exist");
-    if(sz - i < PGSIZE)
-      n = sz - i;
-    else
-      n = PGSIZE;
-    if(readi(ip, 0, (uint64)pa, offset+i, n) != n)
-      return -1;
-  }
-  
-  return 0;
-}
@@ -3,3 +3,10 @@
 #define O_RDWR    0x002
 #define O_CREATE  0x200
 #define O_TRUNC   0x400
+#define O_NONBLOCK 0x800
+
+// fcntl() commands
+#define F_GETPIPE_SZ 1  // size of a pipe's buffer, in bytes
+#define F_SETPIPE_SZ 2  // resize a pipe's buffer; returns the new size
+#define F_GETFL      3  // O_ flags of an open file
+#define F_SETFL      4  // set O_NONBLOCK or clear it
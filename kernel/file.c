@@ -12,17 +12,23 @@
 #include "file.h"
 #include "stat.h"
 #include "proc.h"
+#include "slab.h"
+#include "poll.h"
 
 struct devsw devsw[NDEV];
+
+// file structures come from filecache; ftable.lock
+// protects their reference counts.
 struct {
   struct spinlock lock;
-  struct file file[NFILE];
 } ftable;
+struct objcache filecache;
 
 void
 fileinit(void)
 {
   initlock(&ftable.lock, "ftable");
+  objcache_init(&filecache, "file", sizeof(struct file), 0);
 }
 
 // Allocate a file structure.
@@ -31,16 +37,11 @@ filealloc(void)
 {
   struct file *f;
 
-  acquire(&ftable.lock);
-  for(f = ftable.file; f < ftable.file + NFILE; f++){
-    if(f->ref == 0){
-      f->ref = 1;
-      release(&ftable.lock);
-      return f;
-    }
-  }
-  release(&ftable.lock);
-  return 0;
+  if((f = objalloc(&filecache)) == 0)
+    return 0;
+  memset(f, 0, sizeof(*f));
+  f->ref = 1;
+  return f;
 }
 
 // Increment ref count for file f.
@@ -72,6 +73,7 @@ fileclose(struct file *f)
   f->ref = 0;
   f->type = FD_NONE;
   release(&ftable.lock);
+  objfree(&filecache, f);
 
   if(ff.type == FD_PIPE){
     pipeclose(ff.pipe, ff.writable);
@@ -101,10 +103,10 @@ filestat(struct file *f, uint64 addr)
   return -1;
 }
 
-// Read from file f.
-// addr is a user virtual address.
-int
-fileread(struct file *f, uint64 addr, int n)
+// Read from file f to addr, a user virtual address
+// if user_dst is set, else a kernel address.
+static int
+fileread1(struct file *f, int user_dst, uint64 addr, int n)
 {
   int r = 0;
 
@@ -112,14 +114,14 @@ fileread(struct file *f, uint64 addr, int n)
     return -1;
 
   if(f->type == FD_PIPE){
-    r = piperead(f->pipe, addr, n);
+    r = piperead(f->pipe, user_dst, addr, n, f->nonblock);
   } else if(f->type == FD_DEVICE){
     if(f->major < 0 || f->major >= NDEV || !devsw[f->major].read)
       return -1;
-    r = devsw[f->major].read(1, addr, n);
+    r = devsw[f->major].read(user_dst, addr, n, f->nonblock);
   } else if(f->type == FD_INODE){
     ilock(f->ip);
-    if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
+    if((r = readi(f->ip, user_dst, addr, f->off, n)) > 0)
       f->off += r;
     iunlock(f->ip);
   } else {
@@ -129,10 +131,18 @@ fileread(struct file *f, uint64 addr, int n)
   return r;
 }
 
-// Write to file f.
+// Read from file f.
 // addr is a user virtual address.
 int
-filewrite(struct file *f, uint64 addr, int n)
+fileread(struct file *f, uint64 addr, int n)
+{
+  return fileread1(f, 1, addr, n);
+}
+
+// Write to file f from addr, a user virtual address
+// if user_src is set, else a kernel address.
+static int
+filewrite1(struct file *f, int user_src, uint64 addr, int n)
 {
   int r, ret = 0;
 
@@ -140,11 +150,11 @@ filewrite(struct file *f, uint64 addr, int n)
     return -1;
 
   if(f->type == FD_PIPE){
-    ret = pipewrite(f->pipe, addr, n);
+    ret = pipewrite(f->pipe, user_src, addr, n, f->nonblock);
   } else if(f->type == FD_DEVICE){
     if(f->major < 0 || f->major >= NDEV || !devsw[f->major].write)
       return -1;
-    ret = devsw[f->major].write(1, addr, n);
+    ret = devsw[f->major].write(user_src, addr, n);
   } else if(f->type == FD_INODE){
     // write a few blocks at a time to avoid exceeding
     // the maximum log transaction size, including
@@ -159,7 +169,7 @@ filewrite(struct file *f, uint64 addr, int n)
 
       begin_op();
       ilock(f->ip);
-      if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0)
+      if ((r = writei(f->ip, user_src, addr + i, f->off, n1)) > 0)
         f->off += r;
       iunlock(f->ip);
       end_op();
@@ -178,3 +188,117 @@ filewrite(struct file *f, uint64 addr, int n)
   return ret;
 }
 
+// Write to file f.
+// addr is a user virtual address.
+int
+filewrite(struct file *f, uint64 addr, int n)
+{
+  return filewrite1(f, 1, addr, n);
+}
+
+// Move up to n bytes from in to out, at least one of which
+// must be a pipe, without copying them through user space.
+// The bytes pass through a kernel page, since the file side
+// may sleep for the disk or the log, which it must not do
+// while holding the pipe's spinlock. From a pipe, splice()
+// moves at most a page, and only what is already buffered,
+// as read() would.
+//
+// splice() takes from in only what out accepted: a pipe is
+// peeked at and then consumed by the bytes written, a file's
+// offset is moved back over the bytes that were not. Into a
+// pipe, it reads no more than the pipe has room for.
+// returns the number of bytes moved, or -1.
+int
+filesplice(struct file *in, struct file *out, int n)
+{
+  char *buf;
+  int m, r, w, space, total;
+  uint off;
+
+  if(in->readable == 0 || out->writable == 0)
+    return -1;
+  if(in->type != FD_PIPE && out->type != FD_PIPE)
+    return -1;
+  if(in->type == FD_PIPE && out->type == FD_PIPE && in->pipe == out->pipe)
+    return -1;
+  if((buf = kalloc()) == 0)
+    return -1;
+
+  for(total = 0; total < n; ){
+    m = n - total;
+    if(m > PGSIZE)
+      m = PGSIZE;
+    if(out->type == FD_PIPE){
+      if((space = pipespace(out->pipe, out->nonblock)) <= 0){
+        if(total == 0)
+          total = -1;
+        break;
+      }
+      if(m > space)
+        m = space;
+    }
+    if(in->type == FD_PIPE)
+      r = pipepeek(in->pipe, buf, m, in->nonblock);
+    else
+      r = fileread1(in, 0, (uint64)buf, m);
+    if(r <= 0){
+      if(r < 0 && total == 0)
+        total = -1;
+      break;
+    }
+    off = out->off;
+    if((w = filewrite1(out, 0, (uint64)buf, r)) < 0){
+      // a file may have taken some of the bytes.
+      w = 0;
+      if(out->type == FD_INODE){
+        ilock(out->ip);
+        w = out->off - off;
+        iunlock(out->ip);
+      }
+    }
+    if(in->type == FD_PIPE){
+      pipeconsume(in->pipe, w);
+    } else if(in->type == FD_INODE && w < r){
+      ilock(in->ip);
+      in->off -= r - w;
+      iunlock(in->ip);
+    }
+    total += w;
+    if(w < r){
+      if(total == 0)
+        total = -1;
+      break;
+    }
+    if(in->type == FD_PIPE)
+      break;
+  }
+  kfree(buf);
+  return total;
+}
+
+// Return the poll() bits that are ready for f, after putting
+// w (if not 0) on the wait queue of f's pipe or device.
+// Inodes are always ready.
+int
+filepoll(struct file *f, struct pollwait *w)
+{
+  int mask;
+
+  if(f->type == FD_PIPE){
+    mask = pipepoll(f->pipe, f->writable, w);
+  } else if(f->type == FD_DEVICE){
+    if(f->major < 0 || f->major >= NDEV)
+      return POLLNVAL;
+    mask = POLLIN | POLLOUT;
+    if(devsw[f->major].poll)
+      mask = devsw[f->major].poll(w);
+  } else {
+    mask = POLLIN | POLLOUT;
+  }
+  if(!f->readable)
+    mask &= ~POLLIN;
+  if(!f->writable)
+    mask &= ~POLLOUT;
+  return mask;
+}
@@ -3,6 +3,7 @@ struct file {
   int ref; // reference count
   char readable;
   char writable;
+  char nonblock;     // O_NONBLOCK: fail reads and writes that would sleep
   struct pipe *pipe; // FD_PIPE
   struct inode *ip;  // FD_INODE and FD_DEVICE
   uint off;          // FD_INODE
@@ -29,10 +30,15 @@ struct inode {
   uint addrs[NDIRECT+1];
 };
 
+struct pollwait;
+
 // map major device number to device functions.
+// read's last argument is nonblock; poll returns
+// POLLIN and POLLOUT bits, like pipepoll().
 struct devsw {
-  int (*read)(int, uint64, int);
+  int (*read)(int, uint64, int, int);
   int (*write)(int, uint64, int);
+  int (*poll)(struct pollwait*);
 };
 
 extern struct devsw devsw[];
@@ -1,6 +1,7 @@
 // Physical memory allocator, for user processes,
 // kernel stacks, page-table pages,
-// and pipe buffers. Allocates whole 4096-byte pages.
+// and pipe buffers. Allocates whole 4096-byte pages,
+// or, with kalloc_order(), aligned power-of-two runs of them.
 
 #include "types.h"
 #include "param.h"
@@ -8,6 +9,7 @@
 #include "spinlock.h"
 #include "riscv.h"
 #include "defs.h"
+#include "memstat.h"
 
 void freerange(void *pa_start, void *pa_end);
 
@@ -16,17 +18,92 @@ extern char end[]; // first address after kernel.
 
 struct run {
   struct run *next;
+  struct run *prev;       // kmem free lists only
 };
 
+// kmem is a buddy allocator over [end, PHYSTOP). A free block of
+// order k is 2^k pages, aligned (relative to KERNBASE) to its size,
+// and sits on kmem.freelist[k]. kmem.order[] records, for the first
+// page of each free block, its order plus one, and 0 for every other
+// page, so kfree_order() can tell in O(1) whether a block's buddy is
+// free and can be merged with it.
+#define NPAGE      ((PHYSTOP - KERNBASE) / PGSIZE)
+#define PFN(pa)    (((uint64)(pa) - KERNBASE) >> PGSHIFT)
+#define PFN2PA(n)  (KERNBASE + ((uint64)(n) << PGSHIFT))
+
 struct {
   struct spinlock lock;
-  struct run *freelist;
+  struct run *freelist[MAXORDER+1];
+  uint64 nblocks[MAXORDER+1];
+  uchar order[NPAGE];
 } kmem;
 
+// Each CPU keeps a cache of free pages in front of kmem, so that
+// most kalloc() and kfree() calls touch only this CPU's list.
+// Pages move between a cache and kmem KCACHE_BATCH at a time.
+// A cache's lock is only contended when another CPU, having
+// found kmem empty, steals from it.
+#define KCACHE_BATCH 32
+#define KCACHE_MAX   (4*KCACHE_BATCH)
+
+struct kcache {
+  struct spinlock lock;
+  struct run *freelist;
+  int n;                  // number of pages on freelist
+} kcache[NCPU];
+
+// Pages zeroed ahead of time, for kzalloc(). scheduler() tops
+// the pool up with kzero_idle() when it has nothing to run.
+#define KZPOOL_MAX 64
+
+struct {
+  struct spinlock lock;
+  struct run *freelist;
+  int n;
+} kzpool;
+
+uint64 npage;  // pages handed to the allocator by freerange()
+
+// Reference counts of pages from kalloc(), so that pages can be
+// shared copy-on-write (see uvmcopy()). kalloc() sets a page's
+// count to 1, krefpage() adds a reference, and kfree() drops one,
+// freeing the page only when the last reference goes away.
+int pageref[NPAGE];
+
+#ifdef KALLOC_DEBUG
+// Debug mode (make KALLOC_DEBUG=1): fill free memory with junk
+// to catch dangling refs, and check that the junk is intact when
+// the memory is allocated again, to catch writes after free.
+// The first struct run of a free block holds free-list links.
+static void
+poison(void *pa, uint64 n)
+{
+  memset(pa, 1, n);
+}
+
+static void
+checkpoison(void *pa, uint64 n)
+{
+  for(char *p = (char*)pa + sizeof(struct run); p < (char*)pa + n; p++){
+    if(*p != 1){
+      printf("kalloc: %p modified after free\n", p);
+      panic("kalloc: use after free");
+    }
+  }
+  memset(pa, 5, n); // fill with junk
+}
+#else
+#define poison(pa, n)       ((void)0)
+#define checkpoison(pa, n)  ((void)0)
+#endif
+
 void
 kinit()
 {
   initlock(&kmem.lock, "kmem");
+  initlock(&kzpool.lock, "kzpool");
+  for(int i = 0; i < NCPU; i++)
+    initlock(&kcache[i].lock, "kcache");
   freerange(end, (void*)PHYSTOP);
 }
 
@@ -35,8 +112,221 @@ freerange(void *pa_start, void *pa_end)
 {
   char *p;
   p = (char*)PGROUNDUP((uint64)pa_start);
-  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE)
-    kfree(p);
+  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE){
+    kfree_order(p, 0);
+    npage++;
+  }
+}
+
+// Caller must hold kmem.lock.
+static void
+buddy_push(struct run *r, int order)
+{
+  r->prev = 0;
+  r->next = kmem.freelist[order];
+  if(r->next)
+    r->next->prev = r;
+  kmem.freelist[order] = r;
+  kmem.order[PFN(r)] = order + 1;
+  kmem.nblocks[order]++;
+}
+
+// Caller must hold kmem.lock.
+static void
+buddy_unlink(struct run *r, int order)
+{
+  if(r->prev)
+    r->prev->next = r->next;
+  else
+    kmem.freelist[order] = r->next;
+  if(r->next)
+    r->next->prev = r->prev;
+  kmem.order[PFN(r)] = 0;
+  kmem.nblocks[order]--;
+}
+
+// Take a block of the given order, splitting a larger one
+// if necessary. Caller must hold kmem.lock.
+static struct run *
+buddy_alloc(int order)
+{
+  struct run *r;
+  int k;
+
+  for(k = order; k <= MAXORDER && kmem.freelist[k] == 0; k++)
+    ;
+  if(k > MAXORDER)
+    return 0;
+  r = kmem.freelist[k];
+  buddy_unlink(r, k);
+  // give back the upper half until the block is the right size.
+  while(k > order){
+    k--;
+    buddy_push((struct run*)((char*)r + ((uint64)PGSIZE << k)), k);
+  }
+  return r;
+}
+
+// Return a block to the free lists, merging it with
+// its buddy for as long as the buddy is free too.
+// Caller must hold kmem.lock.
+static void
+buddy_free(struct run *r, int order)
+{
+  uint64 pfn = PFN(r), bpfn;
+
+  // links left by a per-CPU cache would break the poison
+  // once this block is merged into a bigger one.
+  poison(r, sizeof(struct run));
+  for(; order < MAXORDER; order++){
+    bpfn = pfn ^ (1L << order);
+    if(bpfn >= NPAGE || kmem.order[bpfn] != order + 1)
+      break;
+    buddy_unlink((struct run*)PFN2PA(bpfn), order);
+    poison((void*)PFN2PA(bpfn), sizeof(struct run));
+    pfn &= ~(1L << order);
+  }
+  buddy_push((struct run*)PFN2PA(pfn), order);
+}
+
+// Allocate 2^order physically contiguous pages, aligned to
+// their size. Returns 0 if no such block is free.
+void *
+kalloc_order(int order)
+{
+  struct run *r;
+
+  if(order < 0 || order > MAXORDER)
+    return 0;
+  if(order == 0)
+    return kalloc();
+
+  acquire(&kmem.lock);
+  r = buddy_alloc(order);
+  release(&kmem.lock);
+
+  if(r)
+    checkpoison(r, (uint64)PGSIZE << order);
+  return (void*)r;
+}
+
+// Free a block from kalloc_order(); order must match.
+// kfree_order(pa, 0) bypasses the per-CPU caches.
+void
+kfree_order(void *pa, int order)
+{
+  if(order < 0 || order > MAXORDER ||
+     ((uint64)pa - KERNBASE) % ((uint64)PGSIZE << order) != 0 ||
+     (char*)pa < end || (uint64)pa + ((uint64)PGSIZE << order) > PHYSTOP)
+    panic("kfree_order");
+
+  poison(pa, (uint64)PGSIZE << order);
+
+  acquire(&kmem.lock);
+  buddy_free((struct run*)pa, order);
+  release(&kmem.lock);
+}
+
+// Let the 2^order pages of a block from kalloc_order()
+// be freed one at a time by kfree(), like pages from kalloc().
+void
+ksplit(void *pa, int order)
+{
+  for(uint64 i = 0; i < (1L << order); i++)
+    __atomic_store_n(&pageref[PFN(pa) + i], 1, __ATOMIC_RELAXED);
+}
+
+// Fill in *st with the allocator's statistics.
+void
+kmemstat(struct memstat *st)
+{
+  memset(st, 0, sizeof(*st));
+  st->npages = npage;
+  // no lock on the caches; the counts are only a snapshot.
+  for(int i = 0; i < NCPU; i++)
+    st->ncached += kcache[i].n;
+  st->nzero = kzpool.n;
+  st->nfree = st->ncached + st->nzero;
+  acquire(&kmem.lock);
+  for(int k = 0; k <= MAXORDER; k++){
+    st->nblocks[k] = kmem.nblocks[k];
+    st->nfree += kmem.nblocks[k] << k;
+  }
+  release(&kmem.lock);
+}
+
+// Unlink up to n pages from the front of *list and return
+// them as a list. *got is set to the number taken.
+static struct run *
+takebatch(struct run **list, int n, int *got)
+{
+  struct run *first, *last;
+  int i;
+
+  first = *list;
+  if(first == 0){
+    *got = 0;
+    return 0;
+  }
+  last = first;
+  for(i = 1; i < n && last->next; i++)
+    last = last->next;
+  *list = last->next;
+  last->next = 0;
+  *got = i;
+  return first;
+}
+
+// Find the last page of a non-empty list.
+static struct run *
+lastrun(struct run *r)
+{
+  while(r->next)
+    r = r->next;
+  return r;
+}
+
+// Refill kc, which is empty, from kmem or, failing that,
+// from other CPUs' caches. Returns one page for the caller,
+// or 0 if there is no free memory anywhere.
+// Called with interrupts off and kc->lock not held.
+static struct run *
+kcache_refill(struct kcache *kc)
+{
+  struct run *batch, *r;
+  struct kcache *other;
+  int got;
+
+  batch = 0;
+  acquire(&kmem.lock);
+  for(got = 0; got < KCACHE_BATCH; got++){
+    if((r = buddy_alloc(0)) == 0)
+      break;
+    r->next = batch;
+    batch = r;
+  }
+  release(&kmem.lock);
+
+  // steal half of the first non-empty cache we find.
+  for(other = kcache; batch == 0 && other < &kcache[NCPU]; other++){
+    if(other == kc)
+      continue;
+    acquire(&other->lock);
+    batch = takebatch(&other->freelist, (other->n + 1) / 2, &got);
+    other->n -= got;
+    release(&other->lock);
+  }
+
+  if(batch == 0)
+    return 0;
+  if(got > 1){
+    acquire(&kc->lock);
+    lastrun(batch->next)->next = kc->freelist;
+    kc->freelist = batch->next;
+    kc->n += got - 1;
+    release(&kc->lock);
+  }
+  return batch;
 }
 
 // Free the page of physical memory pointed at by pa,
@@ -46,20 +336,63 @@ freerange(void *pa_start, void *pa_end)
 void
 kfree(void *pa)
 {
-  struct run *r;
+  struct run *r, *batch = 0;
+  struct kcache *kc;
+  int got;
 
   if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
     panic("kfree");
 
-  // Fill with junk to catch dangling refs.
-  memset(pa, 1, PGSIZE);
+  int ref = __atomic_sub_fetch(&pageref[PFN(pa)], 1, __ATOMIC_ACQ_REL);
+  if(ref > 0)
+    return;
+  if(ref < 0)
+    panic("kfree: ref");
+
+  poison(pa, PGSIZE);
 
   r = (struct run*)pa;
 
-  acquire(&kmem.lock);
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  release(&kmem.lock);
+  push_off();
+  kc = &kcache[cpuid()];
+  acquire(&kc->lock);
+  r->next = kc->freelist;
+  kc->freelist = r;
+  kc->n++;
+  // give a batch back to kmem if this cache has grown too big.
+  if(kc->n > KCACHE_MAX){
+    batch = takebatch(&kc->freelist, KCACHE_BATCH, &got);
+    kc->n -= got;
+  }
+  release(&kc->lock);
+
+  if(batch){
+    acquire(&kmem.lock);
+    while((r = batch) != 0){
+      batch = r->next;
+      buddy_free(r, 0);
+    }
+    release(&kmem.lock);
+  }
+  pop_off();
+}
+
+// Take a page from kzpool, or return 0 if it is empty.
+// The page is all zeroes.
+static void *
+kzpool_take(void)
+{
+  struct run *r;
+
+  acquire(&kzpool.lock);
+  if((r = kzpool.freelist) != 0){
+    kzpool.freelist = r->next;
+    kzpool.n--;
+  }
+  release(&kzpool.lock);
+  if(r)
+    r->next = 0;
+  return (void*)r;
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -69,14 +402,79 @@ void *
 kalloc(void)
 {
   struct run *r;
+  struct kcache *kc;
 
-  acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
-  release(&kmem.lock);
+  push_off();
+  kc = &kcache[cpuid()];
+  acquire(&kc->lock);
+  r = kc->freelist;
+  if(r){
+    kc->freelist = r->next;
+    kc->n--;
+  }
+  release(&kc->lock);
+  if(r == 0)
+    r = kcache_refill(kc);
+  pop_off();
 
-  if(r)
-    memset((char*)r, 5, PGSIZE); // fill with junk
+  if(r == 0)
+    return kzpool_take();  // last resort; already counted
+  checkpoison(r, PGSIZE);
+  __atomic_store_n(&pageref[PFN(r)], 1, __ATOMIC_RELAXED);
   return (void*)r;
 }
+
+// Add a reference to a page from kalloc().
+void
+krefpage(void *pa)
+{
+  if(__atomic_fetch_add(&pageref[PFN(pa)], 1, __ATOMIC_RELAXED) < 1)
+    panic("krefpage");
+}
+
+// Return the number of references to a page from kalloc().
+int
+krefcount(void *pa)
+{
+  return __atomic_load_n(&pageref[PFN(pa)], __ATOMIC_ACQUIRE);
+}
+
+// Allocate one zeroed page, preferably one that
+// kzero_idle() zeroed ahead of time.
+// Returns 0 if the memory cannot be allocated.
+void *
+kzalloc(void)
+{
+  void *pa;
+
+  if((pa = kzpool_take()) != 0)
+    return pa;
+  if((pa = kalloc()) != 0)
+    memset(pa, 0, PGSIZE);
+  return pa;
+}
+
+// Zero one free page into kzpool, unless it is already full.
+// Called by scheduler() when there is nothing to run.
+void
+kzero_idle(void)
+{
+  struct run *r;
+
+  if(__atomic_load_n(&kzpool.n, __ATOMIC_RELAXED) >= KZPOOL_MAX)
+    return;
+  if((r = kalloc()) == 0)
+    return;
+  memset(r, 0, PGSIZE);
+
+  acquire(&kzpool.lock);
+  if(kzpool.n < KZPOOL_MAX){
+    r->next = kzpool.freelist;
+    kzpool.freelist = r;
+    kzpool.n++;
+    r = 0;
+  }
+  release(&kzpool.lock);
+  if(r)
+    kfree(r);
+}
@@ -33,6 +33,12 @@
 #define PLIC_SPRIORITY(hart) (PLIC + 0x201000 + (hart)*0x2000)
 #define PLIC_SCLAIM(hart) (PLIC + 0x201004 + (hart)*0x2000)
 
+// frequency of the time CSR (and of stimecmp) on qemu's virt machine.
+#define TIMEBASE_FREQ 10000000L
+
+// time CSR cycles between clock interrupts, about a tenth of a second.
+#define TICKCYCLES 1000000L
+
 // the kernel expects there to be RAM
 // for use by the kernel and user pages
 // from physical address 0x80000000 to PHYSTOP.
@@ -54,6 +60,30 @@
 //   fixed-size stack
 //   expandable heap
 //   ...
+//   UTIME (clock data, shared read-only by every process)
+//   USYSCALL (p->usyscall, read-only to the process)
 //   TRAPFRAME (p->trapframe, used by the trampoline)
 //   TRAMPOLINE (the same page as in the kernel)
 #define TRAPFRAME (TRAMPOLINE - PGSIZE)
+#define USYSCALL (TRAPFRAME - PGSIZE)
+#define UTIME (USYSCALL - PGSIZE)
+
+// user memory (p->sz) must end at or below USERTOP.
+#define USERTOP UTIME
+
+#ifndef __ASSEMBLER__
+// Per-process data that the kernel keeps up to date in a
+// read-only page at USYSCALL, so that the user library can
+// answer getpid() and getpriority() without a system call.
+struct usyscall {
+  int pid;          // Process ID
+  int priority;     // Current priority, including any inherited boost
+};
+
+// Clock data that the kernel keeps up to date in a single
+// page mapped read-only at UTIME in every process.
+struct utime {
+  uint64 ticks;     // clock tick interrupts since boot
+  uint64 timebase;  // frequency of the time CSR, in Hz
+};
+#endif
@@ -0,0 +1,13 @@
+#define MAXORDER 10  // largest kalloc_order() block is 2^MAXORDER pages
+
+// Physical memory statistics, as returned by memstat().
+struct memstat {
+  uint64 npages;                // pages managed by the allocator
+  uint64 nfree;                 // free pages, including ncached
+  uint64 ncached;               // free pages in per-CPU caches
+  uint64 nzero;                 // free pages zeroed ahead for kzalloc()
+  uint64 nblocks[MAXORDER+1];   // free buddy blocks of each order
+  uint64 nused;                 // npages - nfree
+  uint64 rss;                   // pages mapped by the calling process
+  uint64 rsslimit;              // its limit on rss; 0 if none (see memlimit())
+};
@@ -0,0 +1,9 @@
+// mmap() protections
+#define PROT_READ   0x1
+#define PROT_WRITE  0x2
+#define PROT_EXEC   0x4
+
+// mmap() flags
+#define MAP_SHARED  0x01  // writes reach the file and are shared with children
+#define MAP_PRIVATE 0x02  // writes are private copies
+#define MAP_ANON    0x20  // zero-filled memory, no file
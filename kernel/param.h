@@ -1,7 +1,6 @@
 #define NPROC        64  // maximum number of processes
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
 #define NINODE       50  // maximum number of active i-nodes
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
@@ -12,4 +11,9 @@
 #define FSSIZE       2000  // size of file system in blocks
 #define MAXPATH      128   // maximum file path name
 #define USERSTACK    1     // user stack pages
+#define NPILOCK       8  // number of priority-inheritance locks
+#define NVMA         16  // mapped memory regions per process
+#define NSHM         16  // shared memory segments
+#define SHMPAGES     64  // max pages per shared memory segment
+#define PIPEMAXORDER  4  // largest pipe buffer is 2^PIPEMAXORDER pages
 
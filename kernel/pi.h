@@ -0,0 +1,13 @@
+// Priority-inheritance lock interface shared with user space.
+
+#define PI_EDEADLK  (-2)  // pi_acquire() would deadlock
+
+// One edge of the PI wait-for graph, as returned by pi_graph():
+// process waiter is blocked on lock, which holder holds.
+struct pi_edge {
+  int waiter;           // pid of the blocked process
+  int waiter_priority;
+  int lock;             // lock it is blocked on
+  int holder;           // pid holding that lock
+  int holder_priority;
+};
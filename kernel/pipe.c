@@ -7,18 +7,55 @@
 #include "fs.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "slab.h"
+#include "waitq.h"
+#include "poll.h"
 
-#define PIPESIZE 512
+// A pipe's buffer is a separate run of 2^order pages, one page
+// to start with; fcntl(F_SETPIPE_SZ) resizes it, up to
+// PIPEMAXORDER. Sizes are powers of two, so that nread and
+// nwrite index data[] correctly when they wrap around.
 
 struct pipe {
   struct spinlock lock;
-  char data[PIPESIZE];
+  char *data;
+  uint size;      // bytes in data, PGSIZE << order
+  int order;
   uint nread;     // number of bytes read
   uint nwrite;    // number of bytes written
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
+  int rsleep;     // readers asleep on nread
+  int wsleep;     // writers asleep on nwrite
+  uint wlow;      // free bytes that let a sleeping writer go on
+  int splicing;   // a splice() has peeked at the bytes at nread
+  struct waitq wq;  // poll()s waiting on either end
 };
 
+// pipes come from pipecache, several to a page.
+struct objcache pipecache;
+
+static void
+pipector(void *obj)
+{
+  initlock(&((struct pipe*)obj)->lock, "pipe");
+}
+
+void
+pipeinit(void)
+{
+  objcache_init(&pipecache, "pipe", sizeof(struct pipe), pipector);
+}
+
+static void
+pipefreedata(char *data, int order)
+{
+  if(order == 0)
+    kfree(data);
+  else
+    kfree_order(data, order);
+}
+
 int
 pipealloc(struct file **f0, struct file **f1)
 {
@@ -28,13 +65,20 @@ pipealloc(struct file **f0, struct file **f1)
   *f0 = *f1 = 0;
   if((*f0 = filealloc()) == 0 || (*f1 = filealloc()) == 0)
     goto bad;
-  if((pi = (struct pipe*)kalloc()) == 0)
+  if((pi = (struct pipe*)objalloc(&pipecache)) == 0)
     goto bad;
+  if((pi->data = kalloc()) == 0)
+    goto bad;
+  pi->size = PGSIZE;
+  pi->order = 0;
   pi->readopen = 1;
   pi->writeopen = 1;
+  pi->rsleep = 0;
+  pi->wsleep = 0;
+  pi->splicing = 0;
+  pi->wq.head = 0;
   pi->nwrite = 0;
   pi->nread = 0;
-  initlock(&pi->lock, "pipe");
   (*f0)->type = FD_PIPE;
   (*f0)->readable = 1;
   (*f0)->writable = 0;
@@ -46,8 +90,11 @@ pipealloc(struct file **f0, struct file **f1)
   return 0;
 
  bad:
-  if(pi)
-    kfree((char*)pi);
+  if(pi){
+    if(pi->data)
+      kfree(pi->data);
+    objfree(&pipecache, pi);
+  }
   if(*f0)
     fileclose(*f0);
   if(*f1)
@@ -66,17 +113,31 @@ pipeclose(struct pipe *pi, int writable)
     pi->readopen = 0;
     wakeup(&pi->nwrite);
   }
+  waitqwake(&pi->wq);
   if(pi->readopen == 0 && pi->writeopen == 0){
     release(&pi->lock);
-    kfree((char*)pi);
+    pipefreedata(pi->data, pi->order);
+    objfree(&pipecache, pi);
   } else
     release(&pi->lock);
 }
 
+// pipewrite() and piperead() move each run of bytes that is
+// contiguous in pi->data with one copyin() or copyout(), which
+// walks the page table once per user page rather than per byte.
+// addr is a user virtual address if user_src (user_dst) is set,
+// else a kernel address.
+//
+// Each side wakes the other only if it is asleep and can now make
+// progress: a reader as soon as there are bytes to read, a writer
+// once wlow bytes are free, which is half the buffer or whatever
+// is left of its write if less, so that a streaming writer fills
+// the buffer in large runs instead of one reader call at a time.
+
 int
-pipewrite(struct pipe *pi, uint64 addr, int n)
+pipewrite(struct pipe *pi, int user_src, uint64 addr, int n, int nonblock)
 {
-  int i = 0;
+  int i = 0, m;
   struct proc *pr = myproc();
 
   acquire(&pi->lock);
@@ -85,50 +146,250 @@ pipewrite(struct pipe *pi, uint64 addr, int n)
       release(&pi->lock);
       return -1;
     }
-    if(pi->nwrite == pi->nread + PIPESIZE){ //DOC: pipewrite-full
-      wakeup(&pi->nread);
+    if(pi->nwrite == pi->nread + pi->size){ //DOC: pipewrite-full
+      if(nonblock){
+        if(i == 0)
+          i = -1;
+        break;
+      }
+      if(pi->rsleep)
+        wakeup(&pi->nread);
+      waitqwake(&pi->wq);
+      m = n - i < pi->size / 2 ? n - i : pi->size / 2;
+      if(pi->wsleep == 0 || m < pi->wlow)
+        pi->wlow = m;
+      pi->wsleep++;
       sleep(&pi->nwrite, &pi->lock);
+      pi->wsleep--;
     } else {
-      char ch;
-      if(copyin(pr->pagetable, &ch, addr + i, 1) == -1)
+      // free space up to the end of data[].
+      m = pi->size - pi->nwrite % pi->size;
+      if(m > pi->nread + pi->size - pi->nwrite)
+        m = pi->nread + pi->size - pi->nwrite;
+      if(m > n - i)
+        m = n - i;
+      if(either_copyin(&pi->data[pi->nwrite % pi->size], user_src, addr + i, m) == -1)
         break;
-      pi->data[pi->nwrite++ % PIPESIZE] = ch;
-      i++;
+      pi->nwrite += m;
+      i += m;
     }
   }
-  wakeup(&pi->nread);
+  if(pi->rsleep && pi->nwrite != pi->nread)
+    wakeup(&pi->nread);
+  if(i > 0)
+    waitqwake(&pi->wq);
   release(&pi->lock);
 
   return i;
 }
 
+// Return the number of bytes pipewrite() could take from a
+// writer right now, waiting as pipewrite() does for some to
+// free up unless nonblock. splice() asks first, so that it
+// never reads more than it can pass on.
+// returns -1 if the reader has gone or we were killed.
 int
-piperead(struct pipe *pi, uint64 addr, int n)
+pipespace(struct pipe *pi, int nonblock)
 {
-  int i;
+  int m;
   struct proc *pr = myproc();
-  char ch;
 
   acquire(&pi->lock);
-  while(pi->nread == pi->nwrite && pi->writeopen){  //DOC: pipe-empty
-    if(killed(pr)){
+  for(;;){
+    if(pi->readopen == 0 || killed(pr)){
+      m = -1;
+      break;
+    }
+    m = pi->nread + pi->size - pi->nwrite;
+    if(m > 0 || nonblock)
+      break;
+    if(pi->rsleep)
+      wakeup(&pi->nread);
+    waitqwake(&pi->wq);
+    if(pi->wsleep == 0 || pi->size / 2 < pi->wlow)
+      pi->wlow = pi->size / 2;
+    pi->wsleep++;
+    sleep(&pi->nwrite, &pi->lock);
+    pi->wsleep--;
+  }
+  release(&pi->lock);
+  return m;
+}
+
+int
+piperead(struct pipe *pi, int user_dst, uint64 addr, int n, int nonblock)
+{
+  int i, m;
+  struct proc *pr = myproc();
+
+  acquire(&pi->lock);
+  while(pi->splicing || (pi->nread == pi->nwrite && pi->writeopen)){  //DOC: pipe-empty
+    if(nonblock || killed(pr)){
       release(&pi->lock);
       return -1;
     }
+    pi->rsleep++;
     sleep(&pi->nread, &pi->lock); //DOC: piperead-sleep
+    pi->rsleep--;
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(pi->nread == pi->nwrite)
-      break;
-    ch = pi->data[pi->nread % PIPESIZE];
-    if(copyout(pr->pagetable, addr + i, &ch, 1) == -1) {
+  for(i = 0; i < n && pi->nread != pi->nwrite; i += m){  //DOC: piperead-copy
+    // buffered bytes up to the end of data[].
+    m = pi->size - pi->nread % pi->size;
+    if(m > pi->nwrite - pi->nread)
+      m = pi->nwrite - pi->nread;
+    if(m > n - i)
+      m = n - i;
+    if(either_copyout(user_dst, addr + i, &pi->data[pi->nread % pi->size], m) == -1) {
       if(i == 0)
         i = -1;
       break;
     }
-    pi->nread++;
+    pi->nread += m;
+  }
+  if(pi->wsleep && pi->nread + pi->size - pi->nwrite >= pi->wlow)
+    wakeup(&pi->nwrite);  //DOC: piperead-wakeup
+  if(i > 0)
+    waitqwake(&pi->wq);
+  release(&pi->lock);
+  return i;
+}
+
+// splice() out of a pipe copies up to n buffered bytes into
+// buf with pipepeek(), and once it knows how many of them it
+// passed on, consumes just those with pipeconsume(). Other
+// readers wait in between, so the bytes left behind are still
+// the next ones read.
+// returns the number of bytes copied, or -1.
+int
+pipepeek(struct pipe *pi, char *buf, int n, int nonblock)
+{
+  int i, m;
+  uint off;
+  struct proc *pr = myproc();
+
+  acquire(&pi->lock);
+  while(pi->splicing || (pi->nread == pi->nwrite && pi->writeopen)){
+    if(nonblock || killed(pr)){
+      release(&pi->lock);
+      return -1;
+    }
+    pi->rsleep++;
+    sleep(&pi->nread, &pi->lock);
+    pi->rsleep--;
+  }
+  for(i = 0; i < n && pi->nread + i != pi->nwrite; i += m){
+    off = (pi->nread + i) % pi->size;
+    m = pi->size - off;
+    if(m > pi->nwrite - pi->nread - i)
+      m = pi->nwrite - pi->nread - i;
+    if(m > n - i)
+      m = n - i;
+    memmove(buf + i, &pi->data[off], m);
   }
-  wakeup(&pi->nwrite);  //DOC: piperead-wakeup
+  if(i > 0)
+    pi->splicing = 1;
   release(&pi->lock);
   return i;
 }
+
+// Consume n of the bytes pipepeek() returned.
+void
+pipeconsume(struct pipe *pi, int n)
+{
+  acquire(&pi->lock);
+  pi->nread += n;
+  pi->splicing = 0;
+  if(pi->rsleep)
+    wakeup(&pi->nread);
+  if(pi->wsleep && pi->nread + pi->size - pi->nwrite >= pi->wlow)
+    wakeup(&pi->nwrite);
+  waitqwake(&pi->wq);
+  release(&pi->lock);
+}
+
+// Return the size of pi's buffer in bytes.
+int
+pipegetsize(struct pipe *pi)
+{
+  int size;
+
+  acquire(&pi->lock);
+  size = pi->size;
+  release(&pi->lock);
+  return size;
+}
+
+// Resize pi's buffer to hold at least n bytes, rounded up
+// to a power-of-two number of pages.
+// returns the new size, or -1 if n is too large, memory is
+// short, or more than the new size is buffered.
+int
+pipesetsize(struct pipe *pi, int n)
+{
+  int order, oldorder;
+  uint size, i, m;
+  char *data, *old;
+
+  for(order = 0; (PGSIZE << order) < n; order++)
+    if(order == PIPEMAXORDER)
+      return -1;
+  size = PGSIZE << order;
+  if((data = kalloc_order(order)) == 0)
+    return -1;
+
+  acquire(&pi->lock);
+  if(pi->nwrite - pi->nread > size){
+    release(&pi->lock);
+    pipefreedata(data, order);
+    return -1;
+  }
+  // move the buffered bytes to the start of the new buffer.
+  for(i = 0; pi->nread + i != pi->nwrite; ){
+    m = pi->size - (pi->nread + i) % pi->size;
+    if(m > pi->nwrite - pi->nread - i)
+      m = pi->nwrite - pi->nread - i;
+    memmove(data + i, &pi->data[(pi->nread + i) % pi->size], m);
+    i += m;
+  }
+  old = pi->data;
+  oldorder = pi->order;
+  pi->data = data;
+  pi->size = size;
+  pi->order = order;
+  pi->nread = 0;
+  pi->nwrite = i;
+  if(pi->wlow > size / 2)
+    pi->wlow = size / 2;
+  if(pi->wsleep)
+    wakeup(&pi->nwrite);
+  waitqwake(&pi->wq);
+  release(&pi->lock);
+
+  pipefreedata(old, oldorder);
+  return size;
+}
+
+// Return the POLLIN, POLLOUT and POLLHUP bits of pi's read
+// end, or of its write end if writable, after putting w (if
+// not 0) on pi's wait queue.
+int
+pipepoll(struct pipe *pi, int writable, struct pollwait *w)
+{
+  int mask = 0;
+
+  acquire(&pi->lock);
+  pollwait(&pi->wq, w);
+  if(writable){
+    if(pi->readopen == 0)
+      mask |= POLLOUT | POLLHUP;
+    else if(pi->nwrite != pi->nread + pi->size)
+      mask |= POLLOUT;
+  } else {
+    if(pi->nread != pi->nwrite)
+      mask |= POLLIN;
+    if(pi->writeopen == 0)
+      mask |= POLLIN | POLLHUP;
+  }
+  release(&pi->lock);
+  return mask;
+}
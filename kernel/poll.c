@@ -0,0 +1,161 @@
+// poll(): wait for any of several files to be ready.
+//
+// poll() puts an entry on the wait queue of each pipe or device
+// it waits on, then checks whether any is ready, and if none is,
+// sleeps until waitqwake() marks one of its entries woken. Since
+// the entries are queued before the checks, a wakeup between a
+// check and the sleep is not lost. A timeout also puts an entry
+// on tickq, which clockintr() wakes every tick.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "waitq.h"
+#include "poll.h"
+#include "defs.h"
+
+struct spinlock polllock;
+
+void
+pollinit(void)
+{
+  initlock(&polllock, "poll");
+}
+
+static void
+waitqadd(struct waitq *q, struct pollwait *w)
+{
+  acquire(&polllock);
+  w->q = q;
+  w->woken = 0;
+  w->next = q->head;
+  q->head = w;
+  release(&polllock);
+}
+
+static void
+waitqdel(struct pollwait *w)
+{
+  struct pollwait **pp;
+
+  acquire(&polllock);
+  for(pp = &w->q->head; *pp; pp = &(*pp)->next){
+    if(*pp == w){
+      *pp = w->next;
+      break;
+    }
+  }
+  w->q = 0;
+  release(&polllock);
+}
+
+// Put w on q, for an object's poll function,
+// unless w is 0 because poll() is only checking.
+void
+pollwait(struct waitq *q, struct pollwait *w)
+{
+  if(w)
+    waitqadd(q, w);
+}
+
+// Wake the poll() calls waiting on q. The caller holds the
+// lock that protects the state change it is announcing.
+// Cheap when nothing waits, so callable on every change.
+void
+waitqwake(struct waitq *q)
+{
+  struct pollwait *w;
+
+  if(__atomic_load_n(&q->head, __ATOMIC_ACQUIRE) == 0)
+    return;
+  acquire(&polllock);
+  for(w = q->head; w; w = w->next){
+    // if woken is still set, poll() has yet to look and will not sleep.
+    if(!w->woken){
+      w->woken = 1;
+      wakeup(w->chan);
+    }
+  }
+  release(&polllock);
+}
+
+// Set revents for each of the nfds pollfds at user address
+// addr, waiting up to timeout milliseconds (forever if
+// negative) for at least one to be ready.
+// returns the number that are, or -1.
+int
+kpoll(uint64 addr, int nfds, int timeout)
+{
+  struct proc *p = myproc();
+  struct pollfd fds[NOFILE];
+  struct pollwait w[NOFILE+1];  // one per fd, one for tickq
+  struct pollwait *tw = &w[NOFILE];
+  struct file *f;
+  uint64 deadline = 0;
+  int i, n, first, ready;
+
+  if(nfds < 0 || nfds > NOFILE)
+    return -1;
+  if(copyin(p->pagetable, (char*)fds, addr, nfds * sizeof(fds[0])) < 0)
+    return -1;
+  memset(w, 0, sizeof(w));
+  for(i = 0; i <= NOFILE; i++)
+    w[i].chan = w;
+  if(timeout > 0)
+    deadline = readticks() + ((uint64)timeout * (TIMEBASE_FREQ / TICKCYCLES) + 999) / 1000;
+
+  for(first = 1; ; first = 0){
+    n = 0;
+    for(i = 0; i < nfds; i++){
+      fds[i].revents = 0;
+      if(fds[i].fd < 0)
+        continue;
+      if(fds[i].fd >= NOFILE || (f = p->ofile[fds[i].fd]) == 0)
+        fds[i].revents = POLLNVAL;
+      else
+        fds[i].revents = filepoll(f, first && timeout != 0 ? &w[i] : 0) &
+                         (fds[i].events | POLLHUP);
+      if(fds[i].revents)
+        n++;
+    }
+    if(n > 0 || timeout == 0)
+      break;
+    if(first && timeout > 0)
+      waitqadd(&tickq, tw);
+
+    // sleep until an fd's object changes; ticks only
+    // mean looking at the deadline again.
+    acquire(&polllock);
+    for(;;){
+      tw->woken = 0;
+      for(ready = 0, i = 0; i < nfds; i++)
+        ready |= w[i].woken;
+      if(ready || (timeout > 0 && readticks() >= deadline) || killed(p))
+        break;
+      sleep(w, &polllock);
+    }
+    for(i = 0; i < nfds; i++)
+      w[i].woken = 0;
+    release(&polllock);
+
+    if(killed(p)){
+      n = -1;
+      break;
+    }
+    if(!ready)
+      break;  // timed out
+  }
+
+  for(i = 0; i <= NOFILE; i++)
+    if(w[i].q)
+      waitqdel(&w[i]);
+  if(n >= 0 && copyout(p->pagetable, addr, (char*)fds, nfds * sizeof(fds[0])) < 0)
+    return -1;
+  return n;
+}
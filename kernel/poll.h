@@ -0,0 +1,11 @@
+// poll() requests and results
+struct pollfd {
+  int fd;          // ignored if negative
+  short events;    // POLLIN and POLLOUT bits to wait for
+  short revents;   // bits that are ready, plus POLLHUP and POLLNVAL
+};
+
+#define POLLIN   0x001  // read() will not block
+#define POLLOUT  0x004  // write() will not block
+#define POLLHUP  0x010  // the other end of the pipe is closed
+#define POLLNVAL 0x020  // fd is not open
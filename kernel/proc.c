@@ -6,12 +6,19 @@
 #include "proc.h"
 #include "defs.h"
 
+#include "pi.h"
+
+// Priority-inheritance locks. All of them, and every proc's
+// pi_waiting field, are protected by pi_graph_lock so that the
+// holder/waiter graph can be walked consistently for deadlock
+// detection and priority propagation.
 struct pi_lock {
   uint locked;                // is it held?
-  struct spinlock lk;         // spinlock protecting these fields (held briefly)
   struct proc *holder;        // who holds it (NULL if free)
-  int original_priority;      // holder's priority before we boosted it (0 = not boosted)
-} pi_lock;
+};
+
+struct pi_lock pi_locks[NPILOCK];
+struct spinlock pi_graph_lock;
 
 struct cpu cpus[NCPU];
 
@@ -22,8 +29,23 @@ struct proc *initproc;
 int nextpid = 1;
 struct spinlock pid_lock;
 
+// pid -> proc hash table, for kkill(). Readers walk the chains
+// without locks, inside rcu_read_lock(); pidhash_lock serializes
+// writers. A proc removed from its chain isn't reused until an
+// RCU grace period has passed (see rcu_gp_done()), so a reader
+// still standing on it never follows a chain that has changed
+// underneath it.
+#define NPIDHASH 64
+#define PIDHASH(pid) ((uint)(pid) % NPIDHASH)
+struct proc *pidhash[NPIDHASH];
+struct spinlock pidhash_lock;
+
+// Current RCU grace period; see rcu_gp_start().
+uint64 rcu_gp;
+
 extern void forkret(void);
 static void freeproc(struct proc *p);
+static void pi_dump(void);
 
 extern char trampoline[]; // trampoline.S
 
@@ -58,12 +80,14 @@ procinit(void)
   struct proc *p;
   
   initlock(&pid_lock, "nextpid");
+  initlock(&pidhash_lock, "pidhash");
   initlock(&wait_lock, "wait_lock");
   initlock(&test_lock, "test_lock");
-  initlock(&pi_lock.lk, "pi_lock");  // CRITICAL: Initialize pi_lock's spinlock
-  pi_lock.locked = 0;
-  pi_lock.holder = 0;
-  pi_lock.original_priority = 0;
+  initlock(&pi_graph_lock, "pi_graph");
+  for(int i = 0; i < NPILOCK; i++){
+    pi_locks[i].locked = 0;
+    pi_locks[i].holder = 0;
+  }
   
   for(p = proc; p < &proc[NPROC]; p++) {
       initlock(&p->lock, "proc");
@@ -103,6 +127,97 @@ myproc(void)
   return p;
 }
 
+// Read-copy-update, for lock-free lookups in the process table.
+//
+// A reader brackets its lookup with rcu_read_lock() and
+// rcu_read_unlock(), which keep it on this CPU, and must not
+// sleep in between. Every pass through scheduler() is therefore
+// a quiescent state in which this CPU holds no RCU references,
+// and scheduler() records the grace period it has seen in
+// c->rcu_seen. A grace period is over once every CPU that runs
+// the scheduler has seen it.
+
+static void
+rcu_read_lock(void)
+{
+  push_off();
+}
+
+static void
+rcu_read_unlock(void)
+{
+  pop_off();
+}
+
+// Start a new grace period after unlinking an object
+// from an RCU-protected structure, and return it.
+static uint64
+rcu_gp_start(void)
+{
+  __sync_synchronize();
+  return __sync_add_and_fetch(&rcu_gp, 1);
+}
+
+// Has every CPU passed a quiescent state since grace
+// period gp started?
+static int
+rcu_gp_done(uint64 gp)
+{
+  struct cpu *c;
+
+  for(c = cpus; c < &cpus[NCPU]; c++){
+    if(c->rcu_online && __atomic_load_n(&c->rcu_seen, __ATOMIC_ACQUIRE) < gp)
+      return 0;
+  }
+  return 1;
+}
+
+// Publish p in the pid hash table.
+static void
+pidhash_insert(struct proc *p)
+{
+  struct proc **head = &pidhash[PIDHASH(p->pid)];
+
+  acquire(&pidhash_lock);
+  p->hnext = *head;
+  __sync_synchronize();   // p->hnext before *head, for readers
+  *head = p;
+  release(&pidhash_lock);
+}
+
+// Unlink p from the pid hash table, if it is there. p->hnext is
+// left alone so that readers standing on p can continue.
+static void
+pidhash_remove(struct proc *p)
+{
+  struct proc **pp;
+
+  acquire(&pidhash_lock);
+  for(pp = &pidhash[PIDHASH(p->pid)]; *pp; pp = &(*pp)->hnext){
+    if(*pp == p){
+      *pp = p->hnext;
+      break;
+    }
+  }
+  release(&pidhash_lock);
+}
+
+// Find the proc with the given pid, or 0.
+// Caller must be inside rcu_read_lock(), and must lock the
+// proc and re-check its pid before relying on it.
+static struct proc*
+pidlookup(int pid)
+{
+  struct proc *p;
+
+  p = __atomic_load_n(&pidhash[PIDHASH(pid)], __ATOMIC_ACQUIRE);
+  for(; p; p = __atomic_load_n(&p->hnext, __ATOMIC_ACQUIRE)){
+    if(p->pid == pid)
+      return p;
+  }
+  return 0;
+}
+
 int
 allocpid()
 {
@@ -124,23 +239,40 @@ static struct proc*
 allocproc(void)
 {
   struct proc *p;
+  int waiting;
 
-  for(p = proc; p < &proc[NPROC]; p++) {
-    acquire(&p->lock);
-    if(p->state == UNUSED) {
-      goto found;
-    } else {
-      release(&p->lock);
+  for(;;){
+    waiting = 0;
+    for(p = proc; p < &proc[NPROC]; p++) {
+      acquire(&p->lock);
+      if(p->state == UNUSED && rcu_gp_done(p->rcu_gp)) {
+        goto found;
+      } else {
+        if(p->state == UNUSED)
+          waiting = 1;
+        release(&p->lock);
+      }
     }
+    if(!waiting)
+      return 0;
+    // A free proc is still waiting out its grace period,
+    // which will end soon once the other CPUs reschedule.
+    yield();
   }
-  return 0;
 
 found:
   p->pid = allocpid();
   p->state = USED;
+  pidhash_insert(p);
    // ADD THESE LINES - Initialize priority fields
   p->priority = PRIORITY_NORMAL;
   p->original_priority = PRIORITY_NORMAL;
+  p->pi_waiting = 0;
+  p->children = 0;
+  p->zombies = 0;
+  p->rss = 0;
+  p->rsslimit = 0;
+  p->ring = 0;
 
   // Allocate a trapframe page.
   if((p->trapframe = (struct trapframe *)kalloc()) == 0){
@@ -149,6 +281,16 @@ found:
     return 0;
   }
 
+  // Allocate the page user space reads getpid() and
+  // getpriority() from.
+  if((p->usyscall = (struct usyscall *)kzalloc()) == 0){
+    freeproc(p);
+    release(&p->lock);
+    return 0;
+  }
+  p->usyscall->pid = p->pid;
+  p->usyscall->priority = p->priority;
+
   // An empty user page table.
   p->pagetable = proc_pagetable(p);
   if(p->pagetable == 0){
@@ -175,16 +317,24 @@ freeproc(struct proc *p)
   if(p->trapframe)
     kfree((void*)p->trapframe);
   p->trapframe = 0;
+  if(p->usyscall)
+    kfree((void*)p->usyscall);
+  p->usyscall = 0;
   if(p->pagetable)
     proc_freepagetable(p->pagetable, p->sz);
   p->pagetable = 0;
   p->sz = 0;
+  if(p->pid){
+    pidhash_remove(p);
+    p->rcu_gp = rcu_gp_start();
+  }
   p->pid = 0;
   p->parent = 0;
   p->name[0] = 0;
   p->chan = 0;
   p->killed = 0;
   p->xstate = 0;
+  p->pi_waiting = 0;
   p->state = UNUSED;
 }
 
@@ -219,6 +369,24 @@ proc_pagetable(struct proc *p)
     return 0;
   }
 
+  // map the per-process and the global read-only data pages
+  // that ulib.c reads instead of making system calls.
+  if(mappages(pagetable, USYSCALL, PGSIZE,
+              (uint64)(p->usyscall), PTE_R | PTE_U) < 0){
+    uvmunmap(pagetable, TRAPFRAME, 1, 0);
+    uvmunmap(pagetable, TRAMPOLINE, 1, 0);
+    uvmfree(pagetable, 0);
+    return 0;
+  }
+  if(mappages(pagetable, UTIME, PGSIZE,
+              (uint64)utime, PTE_R | PTE_U) < 0){
+    uvmunmap(pagetable, USYSCALL, 1, 0);
+    uvmunmap(pagetable, TRAPFRAME, 1, 0);
+    uvmunmap(pagetable, TRAMPOLINE, 1, 0);
+    uvmfree(pagetable, 0);
+    return 0;
+  }
+
   return pagetable;
 }
 
@@ -229,6 +397,8 @@ proc_freepagetable(pagetable_t pagetable, uint64 sz)
 {
   uvmunmap(pagetable, TRAMPOLINE, 1, 0);
   uvmunmap(pagetable, TRAPFRAME, 1, 0);
+  uvmunmap(pagetable, USYSCALL, 1, 0);
+  uvmunmap(pagetable, UTIME, 1, 0);
   uvmfree(pagetable, sz);
 }
 
@@ -258,7 +428,7 @@ growproc(int n)
 
   sz = p->sz;
   if(n > 0){
-    if(sz + n > TRAPFRAME) {
+    if(sz + n > vmalimit(p)) {
       return -1;
     }
     if((sz = uvmalloc(p->pagetable, sz, sz + n, PTE_W)) == 0) {
@@ -266,11 +436,36 @@ growproc(int n)
     }
   } else if(n < 0){
     sz = uvmdealloc(p->pagetable, sz, sz + n);
+    vmatrim(p, p->sz, sz);
   }
   p->sz = sz;
   return 0;
 }
 
+// Each child is on exactly one of its parent's lists:
+// children while it runs, zombies once it has exited.
+// Caller must hold wait_lock.
+static void
+sibling_insert(struct proc **head, struct proc *p)
+{
+  p->sibnext = *head;
+  if(*head)
+    (*head)->sibpprev = &p->sibnext;
+  p->sibpprev = head;
+  *head = p;
+}
+
+// Caller must hold wait_lock.
+static void
+sibling_remove(struct proc *p)
+{
+  *p->sibpprev = p->sibnext;
+  if(p->sibnext)
+    p->sibnext->sibpprev = p->sibpprev;
+  p->sibnext = 0;
+  p->sibpprev = 0;
+}
+
 // Create a new process, copying the parent.
 // Sets up child kernel stack to return as if from fork() system call.
 int
@@ -280,6 +475,8 @@ kfork(void)
   struct proc *np;
   struct proc *p = myproc();
 
+  vmapopulate(p);
+
   // Allocate process.
   if((np = allocproc()) == 0){
     return -1;
@@ -292,6 +489,15 @@ kfork(void)
     return -1;
   }
   np->sz = p->sz;
+  if(vmafork(p, np) < 0){
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
+  // the child maps exactly the parent's pages.
+  np->rss = p->rss;
+  np->rsslimit = p->rsslimit;
+  // np->ring stays 0: vmafork() does not copy the ring.
 
   // copy saved user registers.
   *(np->trapframe) = *(p->trapframe);
@@ -313,6 +519,7 @@ kfork(void)
 
   acquire(&wait_lock);
   np->parent = p;
+  sibling_insert(&p->children, np);
   release(&wait_lock);
 
   acquire(&np->lock);
@@ -329,11 +536,18 @@ reparent(struct proc *p)
 {
   struct proc *pp;
 
-  for(pp = proc; pp < &proc[NPROC]; pp++){
-    if(pp->parent == p){
+  while((pp = p->children) != 0){
+    sibling_remove(pp);
+    pp->parent = initproc;
+    sibling_insert(&initproc->children, pp);
+  }
+  if(p->zombies){
+    while((pp = p->zombies) != 0){
+      sibling_remove(pp);
       pp->parent = initproc;
-      wakeup(initproc);
+      sibling_insert(&initproc->zombies, pp);
     }
+    wakeup(initproc);
   }
 }
 
@@ -361,12 +575,21 @@ kexit(int status)
   iput(p->cwd);
   end_op();
   p->cwd = 0;
+  vmarelease(p->pagetable, p->vma);
+  shmexit(p);
+
+  // Don't leave waiters blocked on locks nobody will release.
+  pi_releaseall(p);
 
   acquire(&wait_lock);
 
   // Give any children to init.
   reparent(p);
 
+  // Let the parent's wait() find us without a scan.
+  sibling_remove(p);
+  sibling_insert(&p->parent->zombies, p);
+
   // Parent might be sleeping in wait().
   wakeup(p->parent);
   
@@ -388,40 +611,39 @@ int
 kwait(uint64 addr)
 {
   struct proc *pp;
-  int havekids, pid;
+  int pid;
   struct proc *p = myproc();
 
+  // the copyout() below runs under wait_lock.
+  if(addr != 0 && vmprefault(p, addr, sizeof(pp->xstate)) < 0)
+    return -1;
+
   acquire(&wait_lock);
 
   for(;;){
-    // Scan through table looking for exited children.
-    havekids = 0;
-    for(pp = proc; pp < &proc[NPROC]; pp++){
-      if(pp->parent == p){
-        // make sure the child isn't still in exit() or swtch().
-        acquire(&pp->lock);
-
-        havekids = 1;
-        if(pp->state == ZOMBIE){
-          // Found one.
-          pid = pp->pid;
-          if(addr != 0 && copyout(p->pagetable, addr, (char *)&pp->xstate,
-                                  sizeof(pp->xstate)) < 0) {
-            release(&pp->lock);
-            release(&wait_lock);
-            return -1;
-          }
-          freeproc(pp);
-          release(&pp->lock);
-          release(&wait_lock);
-          return pid;
-        }
+    // kexit() moves a child to p->zombies before it
+    // releases wait_lock, so any child there has exited.
+    if((pp = p->zombies) != 0){
+      // make sure the child isn't still in exit() or swtch().
+      acquire(&pp->lock);
+      if(pp->state != ZOMBIE)
+        panic("kwait");
+      pid = pp->pid;
+      if(addr != 0 && copyout(p->pagetable, addr, (char *)&pp->xstate,
+                              sizeof(pp->xstate)) < 0) {
         release(&pp->lock);
+        release(&wait_lock);
+        return -1;
       }
+      sibling_remove(pp);
+      freeproc(pp);
+      release(&pp->lock);
+      release(&wait_lock);
+      return pid;
     }
 
     // No point waiting if we don't have any children.
-    if(!havekids || killed(p)){
+    if(p->children == 0 || killed(p)){
       release(&wait_lock);
       return -1;
     }
@@ -445,7 +667,12 @@ scheduler(void)
   struct cpu *c = mycpu();
 
   c->proc = 0;
+  c->rcu_online = 1;
   for(;;){
+    // this CPU holds no RCU references here.
+    __atomic_store_n(&c->rcu_seen, __atomic_load_n(&rcu_gp, __ATOMIC_ACQUIRE),
+                     __ATOMIC_RELEASE);
+
     intr_on();
 
     // Find the highest-priority RUNNABLE process and run it.
@@ -476,6 +703,9 @@ scheduler(void)
       // When we get back, best->lock is still held by convention
       c->proc = 0;
       release(&best->lock);
+    } else {
+      // nothing to run; zero a page for kzalloc() meanwhile.
+      kzero_idle();
     }
   }
 }
@@ -612,20 +842,28 @@ kkill(int pid)
 {
   struct proc *p;
 
-  for(p = proc; p < &proc[NPROC]; p++){
+  if(pid <= 0)
+    return -1;
+
+  rcu_read_lock();
+  if((p = pidlookup(pid)) != 0)
     acquire(&p->lock);
-    if(p->pid == pid){
-      p->killed = 1;
-      if(p->state == SLEEPING){
-        // Wake process from sleep().
-        p->state = RUNNABLE;
-      }
-      release(&p->lock);
-      return 0;
-    }
+  rcu_read_unlock();
+  if(p == 0)
+    return -1;
+
+  // p may have exited and been freed since the lookup.
+  if(p->pid != pid || p->state == UNUSED){
     release(&p->lock);
+    return -1;
+  }
+  p->killed = 1;
+  if(p->state == SLEEPING){
+    // Wake process from sleep().
+    p->state = RUNNABLE;
   }
-  return -1;
+  release(&p->lock);
+  return 0;
 }
 
 void
@@ -705,7 +943,18 @@ procdump(void)
     printf("%d %s %s", p->pid, state, p->name);
     printf("\n");
   }
+  pi_dump();
+}
+
+// Set p's current priority, and publish it in p's USYSCALL
+// page, where the user library's getpriority() reads it.
+static void
+setpri(struct proc *p, int priority)
+{
+  p->priority = priority;
+  p->usyscall->priority = priority;
 }
+
 // System call to set process priority
 uint64
 sys_setpriority(void)
@@ -721,7 +970,7 @@ sys_setpriority(void)
     
   struct proc *p = myproc();
   acquire(&p->lock);
-  p->priority = priority;
+  setpri(p, priority);
   p->original_priority = priority;
   release(&p->lock);
   
@@ -741,113 +990,290 @@ sys_getpriority(void)
   return priority;
 }
 
-// Improved kernel functions for kernel/proc.c
-// Replace the existing sys_test_* functions with these
+// Priority-inheritance locks.
+//
+// Each process blocked in pi_acquire() records the lock it is
+// waiting for in p->pi_waiting, and each held lock records its
+// holder, so the locks and processes form a wait-for graph.
+// A waiter lends its priority to every holder along its chain,
+// and a process that would close a cycle in the graph fails
+// with PI_EDEADLK instead of sleeping forever.
+
+// Return 1 if p blocking on l would close a cycle, that is,
+// if the chain of holders starting at l leads back to p.
+// Caller must hold pi_graph_lock.
+static int
+pi_cycle(struct proc *p, struct pi_lock *l)
+{
+  for(int n = 0; l != 0 && l->locked && n < NPROC; n++){
+    if(l->holder == p)
+      return 1;
+    l = l->holder->pi_waiting;
+  }
+  return 0;
+}
 
-// Fixed kernel functions for kernel/proc.c
-// These replace the existing test functions
+// Lend waiter p's priority to every holder in the chain
+// starting at lock l.
+// Caller must hold pi_graph_lock.
+static void
+pi_propagate(struct proc *p, struct pi_lock *l)
+{
+  for(int n = 0; l != 0 && l->locked && n < NPROC; n++){
+    struct proc *h = l->holder;
+    if(p->priority >= h->priority)
+      break;
 
-// CRITICAL FIX for kernel/proc.c
-// Print AFTER lock operations, not during
+    int old_pri = h->priority;
+    setpri(h, p->priority);
 
-// IMPROVED kernel/proc.c syscalls
-// These detect priority changes and report them
+    printf("\n[KERNEL] *** PRIORITY INHERITANCE TRIGGERED ***\n");
+    printf("[KERNEL] PID=%d PRIORITY BOOSTED %d -> %d\n",
+           h->pid, old_pri, p->priority);
+    printf("[KERNEL] (PID=%d with priority=%d is waiting)\n\n",
+           p->pid, p->priority);
 
-uint64
-sys_test_acquire(void)
+    // JSON log for monitoring system
+    printf("{\"event\":\"priority_boost\",\"holder_pid\":%d,\"old_priority\":%d,\"new_priority\":%d,\"waiter_pid\":%d,\"waiter_priority\":%d,\"lock\":%d}\n",
+           h->pid, old_pri, p->priority, p->pid, p->priority,
+           (int)(l - pi_locks));
+
+    l = h->pi_waiting;
+  }
+}
+
+// The priority h should run at: its own, or that of the most
+// urgent process blocked on a lock h still holds.
+// Caller must hold pi_graph_lock.
+static int
+pi_effective(struct proc *h)
 {
-  struct proc *p = myproc();
+  struct proc *w;
+  int pri = h->original_priority;
 
-  acquire(&pi_lock.lk);
+  for(w = proc; w < &proc[NPROC]; w++){
+    if(w->pi_waiting != 0 && w->pi_waiting->holder == h &&
+       w->priority < pri)
+      pri = w->priority;
+  }
+  return pri;
+}
 
-  // If lock is already held, try to acquire it
-  if(pi_lock.locked) {
-    printf("[KERNEL] PID=%d REQUESTED lock (held by PID=%d)\n", 
-           p->pid, pi_lock.holder ? pi_lock.holder->pid : 0);
+int
+pi_acquire(struct proc *p, int id)
+{
+  struct pi_lock *l = &pi_locks[id];
+
+  acquire(&pi_graph_lock);
+
+  if(l->locked) {
+    printf("[KERNEL] PID=%d REQUESTED lock %d (held by PID=%d)\n",
+           p->pid, id, l->holder->pid);
     printf("[KERNEL] PID=%d BLOCKED\n", p->pid);
-    
+
     // JSON log for monitoring system
-    printf("{\"event\":\"lock_request\",\"pid\":%d,\"priority\":%d,\"holder_pid\":%d,\"holder_priority\":%d}\n",
-           p->pid, p->priority, 
-           pi_lock.holder ? pi_lock.holder->pid : 0,
-           pi_lock.holder ? pi_lock.holder->priority : 0);
+    printf("{\"event\":\"lock_request\",\"pid\":%d,\"priority\":%d,\"holder_pid\":%d,\"holder_priority\":%d,\"lock\":%d}\n",
+           p->pid, p->priority, l->holder->pid, l->holder->priority, id);
   }
 
   // Sleep until the lock is free.
-  while(pi_lock.locked) {
-    // Priority inheritance: if we have higher priority (lower number)
-    // than the current holder, boost the holder up to our level.
-    if(pi_lock.holder != 0 && p->priority < pi_lock.holder->priority) {
-      if(pi_lock.original_priority == 0)
-        pi_lock.original_priority = pi_lock.holder->priority;
-      
-      int old_pri = pi_lock.holder->priority;
-      pi_lock.holder->priority = p->priority;
-      
-      printf("\n[KERNEL] *** PRIORITY INHERITANCE TRIGGERED ***\n");
-      printf("[KERNEL] PID=%d PRIORITY BOOSTED %d -> %d\n", 
-             pi_lock.holder->pid, old_pri, p->priority);
-      printf("[KERNEL] (PID=%d with priority=%d is waiting)\n\n", 
-             p->pid, p->priority);
-      
+  while(l->locked) {
+    if(pi_cycle(p, l)) {
+      printf("[KERNEL] PID=%d DEADLOCK on lock %d (held by PID=%d)\n",
+             p->pid, id, l->holder->pid);
+
       // JSON log for monitoring system
-      printf("{\"event\":\"priority_boost\",\"holder_pid\":%d,\"old_priority\":%d,\"new_priority\":%d,\"waiter_pid\":%d,\"waiter_priority\":%d}\n",
-             pi_lock.holder->pid, old_pri, p->priority, p->pid, p->priority);
+      printf("{\"event\":\"deadlock\",\"pid\":%d,\"lock\":%d,\"holder_pid\":%d}\n",
+             p->pid, id, l->holder->pid);
+
+      release(&pi_graph_lock);
+      return PI_EDEADLK;
     }
-    sleep(&pi_lock, &pi_lock.lk);  // releases pi_lock.lk, re-acquires on wake
+    if(killed(p)) {
+      release(&pi_graph_lock);
+      return -1;
+    }
+
+    p->pi_waiting = l;
+    pi_propagate(p, l);
+    sleep(l, &pi_graph_lock);  // releases pi_graph_lock, re-acquires on wake
+    p->pi_waiting = 0;
   }
 
   // Lock is free — claim it.
-  pi_lock.locked = 1;
-  pi_lock.holder = p;
-  pi_lock.original_priority = 0;  // This holder hasn't been boosted yet
+  l->locked = 1;
+  l->holder = p;
+
+  printf("[KERNEL] PID=%d ACQUIRED lock %d\n", p->pid, id);
 
-  printf("[KERNEL] PID=%d ACQUIRED lock\n", p->pid);
-  
   // JSON log for monitoring system
-  printf("{\"event\":\"lock_acquired\",\"pid\":%d,\"priority\":%d}\n", p->pid, p->priority);
+  printf("{\"event\":\"lock_acquired\",\"pid\":%d,\"priority\":%d,\"lock\":%d}\n",
+         p->pid, p->priority, id);
 
-  release(&pi_lock.lk);
+  release(&pi_graph_lock);
   return 0;
 }
 
-uint64
-sys_test_release(void)
+int
+pi_release(struct proc *p, int id)
 {
-  struct proc *p = myproc();
-  
-  acquire(&pi_lock.lk);
+  struct pi_lock *l = &pi_locks[id];
+
+  acquire(&pi_graph_lock);
+
+  if(!l->locked || l->holder != p) {
+    release(&pi_graph_lock);
+    return -1;
+  }
+  l->locked = 0;
+  l->holder = 0;
+
+  // Drop whatever priority was lent through this lock, keeping
+  // anything still lent through other locks p holds.
+  int old_pri = p->priority;
+  int new_pri = pi_effective(p);
+  if(new_pri != old_pri) {
+    setpri(p, new_pri);
 
-  // --- restore holder's original priority if it was boosted ---
-  if(pi_lock.holder != 0 && pi_lock.original_priority != 0) {
-    int old_pri = pi_lock.holder->priority;
-    pi_lock.holder->priority = pi_lock.original_priority;
-    
     printf("\n[KERNEL] *** PRIORITY RESTORED ***\n");
-    printf("[KERNEL] PID=%d PRIORITY RESTORED %d -> %d\n", 
-           pi_lock.holder->pid, old_pri, pi_lock.original_priority);
-    printf("[KERNEL] PID=%d RELEASED lock\n\n", p->pid);
-    
+    printf("[KERNEL] PID=%d PRIORITY RESTORED %d -> %d\n",
+           p->pid, old_pri, new_pri);
+    printf("[KERNEL] PID=%d RELEASED lock %d\n\n", p->pid, id);
+
     // JSON log for monitoring system
     printf("{\"event\":\"priority_restore\",\"pid\":%d,\"old_priority\":%d,\"new_priority\":%d}\n",
-           pi_lock.holder->pid, old_pri, pi_lock.original_priority);
-    
-    pi_lock.original_priority = 0;
+           p->pid, old_pri, new_pri);
   } else {
-    printf("[KERNEL] PID=%d RELEASED lock\n", p->pid);
+    printf("[KERNEL] PID=%d RELEASED lock %d\n", p->pid, id);
   }
-  
+
   // JSON log for monitoring system
-  printf("{\"event\":\"lock_released\",\"pid\":%d}\n", p->pid);
+  printf("{\"event\":\"lock_released\",\"pid\":%d,\"lock\":%d}\n", p->pid, id);
 
-  pi_lock.locked = 0;
-  pi_lock.holder = 0;
-  wakeup(&pi_lock);             // wake all processes sleeping on this lock
+  wakeup(l);                    // wake all processes sleeping on this lock
 
-  release(&pi_lock.lk);
+  release(&pi_graph_lock);
   return 0;
 }
 
+// Release every PI lock p still holds, so that
+// its waiters are not blocked forever once p exits.
+void
+pi_releaseall(struct proc *p)
+{
+  struct pi_lock *l;
+
+  acquire(&pi_graph_lock);
+  for(l = pi_locks; l < &pi_locks[NPILOCK]; l++){
+    if(l->locked && l->holder == p){
+      l->locked = 0;
+      l->holder = 0;
+      wakeup(l);
+    }
+  }
+  release(&pi_graph_lock);
+}
+
+// Fill edges[] with the current wait-for graph, one edge per
+// blocked process, and return the number of edges.
+// edges[] must have room for NPROC entries.
+static int
+pi_snapshot(struct pi_edge *edges)
+{
+  struct proc *w;
+  struct pi_lock *l;
+  int n = 0;
+
+  for(w = proc; w < &proc[NPROC]; w++){
+    if((l = w->pi_waiting) == 0 || l->holder == 0)
+      continue;
+    edges[n].waiter = w->pid;
+    edges[n].waiter_priority = w->priority;
+    edges[n].lock = l - pi_locks;
+    edges[n].holder = l->holder->pid;
+    edges[n].holder_priority = l->holder->priority;
+    n++;
+  }
+  return n;
+}
+
+// Print the PI wait-for graph to the console, for procdump().
+static void
+pi_dump(void)
+{
+  struct pi_edge edges[NPROC];
+  int n;
+
+  // No lock, like procdump().
+  if((n = pi_snapshot(edges)) == 0)
+    return;
+  printf("pi wait-for graph:\n");
+  for(int i = 0; i < n; i++)
+    printf("  %d (pri %d) -> lock %d -> %d (pri %d)\n",
+           edges[i].waiter, edges[i].waiter_priority, edges[i].lock,
+           edges[i].holder, edges[i].holder_priority);
+}
+
+// The original single-lock test interface uses lock 0.
+uint64
+sys_test_acquire(void)
+{
+  return pi_acquire(myproc(), 0);
+}
+
+uint64
+sys_test_release(void)
+{
+  return pi_release(myproc(), 0);
+}
+
+uint64
+sys_pi_acquire(void)
+{
+  int id;
+
+  argint(0, &id);
+  if(id < 0 || id >= NPILOCK)
+    return -1;
+  return pi_acquire(myproc(), id);
+}
+
+uint64
+sys_pi_release(void)
+{
+  int id;
+
+  argint(0, &id);
+  if(id < 0 || id >= NPILOCK)
+    return -1;
+  return pi_release(myproc(), id);
+}
+
+// Copy up to max edges of the wait-for graph to user
+// address addr. Returns the number of edges copied.
+uint64
+sys_pi_graph(void)
+{
+  struct pi_edge edges[NPROC];
+  uint64 addr;
+  int max, n;
+
+  argaddr(0, &addr);
+  argint(1, &max);
+
+  acquire(&pi_graph_lock);
+  n = pi_snapshot(edges);
+  release(&pi_graph_lock);
+
+  if(max < 0)
+    return -1;
+  if(n > max)
+    n = max;
+  if(copyout(myproc()->pagetable, addr, (char *)edges, n * sizeof(edges[0])) < 0)
+    return -1;
+  return n;
+}
+
 // ---------- REPLACE sys_cpu_work with this ----------
 
 uint64
@@ -28,6 +28,8 @@ struct cpu {
   struct context context;     // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
+  int rcu_online;             // Does this CPU run scheduler()?
+  uint64 rcu_seen;            // Last RCU grace period seen by scheduler().
 };
 
 extern struct cpu cpus[NCPU];
@@ -85,6 +87,23 @@ struct trapframe {
 
 enum procstate { UNUSED, USED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
+// A region of user memory whose pages vmfault() fills in on
+// first touch, from a file or with zeroes; see vma.c.
+// Bytes at or past start+filesz read as zero.
+struct vma {
+  int used;
+  uint64 start;                // page-aligned
+  uint64 end;
+  int perm;                    // PTE_W and PTE_X bits for its pages
+  int flags;                   // MAP_SHARED or MAP_PRIVATE, and VMA_RING
+  struct inode *ip;            // holds a reference; 0 if anonymous
+  struct shmseg *shm;          // holds a reference, if a shm segment
+  uint off;                    // file or segment offset of start
+  uint filesz;
+};
+
+#define VMA_RING 0x100  // ringsetup()'s ring; fork() does not copy it
+
 // Per-process state
 struct proc {
   struct spinlock lock;
@@ -95,19 +114,35 @@ struct proc {
   int killed;                  // If non-zero, have been killed
   int xstate;                  // Exit status to be returned to parent's wait
   int pid;                     // Process ID
+  uint64 rcu_gp;               // Grace period that must end before reuse
 
-  // wait_lock must be held when using this:
+  // pidhash_lock must be held to change this:
+  struct proc *hnext;          // Next in pid hash chain
+
+  // wait_lock must be held when using these:
   struct proc *parent;         // Parent process
+  struct proc *children;       // Children that have not exited
+  struct proc *zombies;        // Exited children not yet waited for
+  struct proc *sibnext;        // Next on parent's children or zombies
+  struct proc **sibpprev;      // Link pointing at this proc
 
   // these are private to the process, so p->lock need not be held.
   uint64 kstack;               // Virtual address of kernel stack
   uint64 sz;                   // Size of process memory (bytes)
+  uint64 rss;                  // Resident user pages; see rssadd()
+  uint64 rsslimit;             // Max rss, or 0 for no limit
+  uint64 ring;                 // Address of ringsetup()'s ring, or 0
   pagetable_t pagetable;       // User page table
   struct trapframe *trapframe; // data page for trampoline.S
+  struct usyscall *usyscall;   // data page shared read-only with user space
   struct context context;      // swtch() here to run process
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
+  struct vma vma[NVMA];        // Mapped memory regions
   char name[16];               // Process name (debugging)
   int priority;                // Process priority (lower = higher priority)
   int original_priority;       // Original priority before any inheritance
+
+  // pi_graph_lock must be held when using this:
+  struct pi_lock *pi_waiting;  // If non-zero, blocked in pi_acquire() on it
 };
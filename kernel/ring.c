@@ -0,0 +1,107 @@
+// Batched system calls through a submission ring and a
+// completion ring that the process and the kernel share.
+//
+// ringsetup() maps a struct ring (ring.h) into the process as
+// an anonymous MAP_SHARED region, marked VMA_RING: fork() does
+// not copy it, and munmap() of any of it forgets the ring.
+// ringenter() then performs the queued operations in order, so
+// one trap pays for a batch. There are no kernel threads to
+// poll the ring or to run the operations in the background:
+// they run in ringenter(), and a read that would block blocks
+// the rest of the batch, unless the file is O_NONBLOCK. The
+// kernel reaches the ring through copyin() and copyout(), like
+// any other user memory.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "mman.h"
+#include "ring.h"
+#include "defs.h"
+
+// Map a ring into p, unless it already has one.
+// returns its address, or -1.
+uint64
+ringsetup(struct proc *p)
+{
+  uint64 va;
+
+  if(p->ring)
+    return p->ring;
+  if((va = vmamap(p, sizeof(struct ring), PTE_W, MAP_SHARED | VMA_RING, 0, 0)) == -1)
+    return -1;
+  p->ring = va;
+  return va;
+}
+
+static int
+ringop(struct proc *p, struct ringsqe *e)
+{
+  struct file *f = 0;
+
+  if(e->op == RING_READ || e->op == RING_WRITE || e->op == RING_FSYNC){
+    if(e->fd < 0 || e->fd >= NOFILE || (f = p->ofile[e->fd]) == 0)
+      return -1;
+  }
+  switch(e->op){
+  case RING_NOP:
+    return 0;
+  case RING_READ:
+    // as in sys_read() and sys_write().
+    if(e->n > 0 && vmprefault(p, e->addr, e->n) < 0)
+      return -1;
+    return fileread(f, e->addr, e->n);
+  case RING_WRITE:
+    if(e->n > 0 && vmprefault(p, e->addr, e->n) < 0)
+      return -1;
+    return filewrite(f, e->addr, e->n);
+  case RING_FSYNC:
+    return 0;
+  case RING_PI_ACQUIRE:
+  case RING_PI_RELEASE:
+    if(e->n < 0 || e->n >= NPILOCK)
+      return -1;
+    if(e->op == RING_PI_ACQUIRE)
+      return pi_acquire(p, e->n);
+    return pi_release(p, e->n);
+  }
+  return -1;
+}
+
+// Perform up to n of p's queued operations, stopping early if
+// the submission ring empties or the completion ring fills.
+// returns the number performed, or -1.
+int
+ringenter(struct proc *p, int n)
+{
+  struct ring *r = (struct ring*)p->ring;  // a user address
+  uint idx[4];  // sqhead, sqtail, cqhead, cqtail
+  struct ringsqe e;
+  struct ringcqe c;
+  int done;
+
+  if(r == 0)
+    return -1;
+  if(copyin(p->pagetable, (char*)idx, (uint64)r, sizeof(idx)) < 0)
+    return -1;
+  for(done = 0; done < n && idx[0] != idx[1] && idx[3] - idx[2] < RINGSIZE; ){
+    if(copyin(p->pagetable, (char*)&e, (uint64)&r->sq[idx[0] % RINGSIZE], sizeof(e)) < 0)
+      break;
+    c.data = e.data;
+    c.res = ringop(p, &e);
+    if(copyout(p->pagetable, (uint64)&r->cq[idx[3] % RINGSIZE], (char*)&c, sizeof(c)) < 0)
+      break;
+    idx[0]++;
+    idx[3]++;
+    done++;
+    if(killed(p))
+      break;
+  }
+  if(copyout(p->pagetable, (uint64)&r->sqhead, (char*)&idx[0], sizeof(idx[0])) < 0 ||
+     copyout(p->pagetable, (uint64)&r->cqtail, (char*)&idx[3], sizeof(idx[3])) < 0)
+    return -1;
+  return done;
+}
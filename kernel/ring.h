@@ -0,0 +1,38 @@
+// Submission and completion rings, for ringsetup() and ringenter().
+//
+// The process fills sq[sqtail % RINGSIZE] and advances sqtail;
+// ringenter() performs entries from sqhead on, posts a completion
+// for each at cq[cqtail % RINGSIZE], and advances sqhead and
+// cqtail. The process then takes completions from cqhead on.
+
+#define RINGSIZE 64  // entries in each ring
+
+// operations
+#define RING_NOP        0
+#define RING_READ       1  // read(fd, addr, n)
+#define RING_WRITE      2  // write(fd, addr, n)
+#define RING_FSYNC      3  // fd's writes are already on disk; checks fd
+#define RING_PI_ACQUIRE 4  // pi_acquire(n)
+#define RING_PI_RELEASE 5  // pi_release(n)
+
+struct ringsqe {
+  int op;
+  int fd;
+  uint64 addr;
+  int n;
+  uint64 data;     // copied to the completion
+};
+
+struct ringcqe {
+  uint64 data;
+  int res;         // what the operation's system call would return
+};
+
+struct ring {
+  uint sqhead;     // written by the kernel
+  uint sqtail;     // written by the process
+  uint cqhead;     // written by the process
+  uint cqtail;     // written by the kernel
+  struct ringsqe sq[RINGSIZE];
+  struct ringcqe cq[RINGSIZE];
+};
@@ -0,0 +1,220 @@
+// Shared memory segments.
+//
+// shmget() finds or creates a segment by key and allocates its
+// pages up front. shmat() maps a segment into the calling
+// process as a MAP_SHARED vma whose pages vmafault() takes from
+// the segment rather than allocating, so every attached process
+// maps the same physical pages. Besides its attachments, a
+// segment holds a reference for its creator, which shmrm() or
+// the creator's exit() drops, taking the segment's key out of
+// use. A segment is freed once it has no references left, so
+// one that is never attached does not outlive its creator.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "mman.h"
+#include "defs.h"
+
+struct shmseg {
+  int used;
+  int key;
+  int ref;           // vmas that refer to this segment, plus creator's
+  int creator;       // pid holding the creation reference, or 0
+  uint npages;
+  char *pages[SHMPAGES];
+};
+
+struct {
+  struct spinlock lock;
+  struct shmseg segs[NSHM];
+} shm;
+
+void
+shminit(void)
+{
+  initlock(&shm.lock, "shm");
+}
+
+// Return the id of the segment with key, creating it with
+// size bytes of zeroed memory if there is none.
+// returns -1 if size is too large for an existing segment,
+// or if a new one cannot be allocated.
+int
+shmget(int key, uint64 size)
+{
+  struct shmseg *s, *free = 0;
+  char *pages[SHMPAGES];
+  uint i, n;
+
+  n = PGROUNDUP(size) / PGSIZE;
+  if(size == 0 || n > SHMPAGES)
+    return -1;
+
+  acquire(&shm.lock);
+  for(s = shm.segs; s < &shm.segs[NSHM]; s++){
+    if(s->used && s->creator && s->key == key){
+      release(&shm.lock);
+      return n <= s->npages ? s - shm.segs : -1;
+    }
+    if(!s->used && free == 0)
+      free = s;
+  }
+  release(&shm.lock);
+  if(free == 0)
+    return -1;
+
+  for(i = 0; i < n; i++){
+    if((pages[i] = kzalloc()) == 0){
+      while(i > 0)
+        kfree(pages[--i]);
+      return -1;
+    }
+  }
+
+  // another process may have created key, or taken the
+  // free slot, while we were allocating.
+  acquire(&shm.lock);
+  for(s = shm.segs; s < &shm.segs[NSHM]; s++)
+    if(s->used && s->creator && s->key == key)
+      break;
+  if(s < &shm.segs[NSHM] || free->used){
+    release(&shm.lock);
+    for(i = 0; i < n; i++)
+      kfree(pages[i]);
+    return shmget(key, size);
+  }
+  free->used = 1;
+  free->key = key;
+  free->ref = 1;
+  free->creator = myproc()->pid;
+  free->npages = n;
+  for(i = 0; i < n; i++)
+    free->pages[i] = pages[i];
+  release(&shm.lock);
+  return free - shm.segs;
+}
+
+// Map segment id into p.
+// returns its address, or -1.
+uint64
+shmattach(struct proc *p, int id)
+{
+  struct shmseg *s;
+  uint64 va;
+
+  if(id < 0 || id >= NSHM)
+    return -1;
+  s = &shm.segs[id];
+
+  acquire(&shm.lock);
+  if(!s->used){
+    release(&shm.lock);
+    return -1;
+  }
+  s->ref++;
+  release(&shm.lock);
+
+  if((va = vmamap(p, (uint64)s->npages * PGSIZE, PTE_W, MAP_SHARED, 0, 0)) == -1){
+    shmput(s);
+    return -1;
+  }
+  vmalookup(p, va)->shm = s;
+  return va;
+}
+
+// Detach the segment that p attached at va.
+int
+shmdetach(struct proc *p, uint64 va)
+{
+  struct vma *v;
+
+  if((v = vmalookup(p, va)) == 0 || v->shm == 0 || v->start != va)
+    return -1;
+  return vmaunmap(p, v->start, v->end - v->start);
+}
+
+// Return the physical page at byte offset off of s.
+char*
+shmpage(struct shmseg *s, uint off)
+{
+  if(off / PGSIZE >= s->npages)
+    panic("shmpage");
+  return s->pages[off / PGSIZE];
+}
+
+// Record another vma that refers to s.
+void
+shmdup(struct shmseg *s)
+{
+  acquire(&shm.lock);
+  s->ref++;
+  release(&shm.lock);
+}
+
+// Drop a reference to s, freeing s with the last one.
+// The segment's pages stay allocated until every page table
+// that maps them has also let go (see kfree()).
+void
+shmput(struct shmseg *s)
+{
+  uint i, n;
+  char *pages[SHMPAGES];
+
+  acquire(&shm.lock);
+  if(--s->ref > 0){
+    release(&shm.lock);
+    return;
+  }
+  n = s->npages;
+  for(i = 0; i < n; i++)
+    pages[i] = s->pages[i];
+  s->used = 0;
+  release(&shm.lock);
+
+  for(i = 0; i < n; i++)
+    kfree(pages[i]);
+}
+
+// Drop the creation reference of segment id, so that its key
+// names a new segment from now on, and the segment is freed
+// with its last attachment.
+int
+shmremove(int id)
+{
+  struct shmseg *s;
+
+  if(id < 0 || id >= NSHM)
+    return -1;
+  s = &shm.segs[id];
+  acquire(&shm.lock);
+  if(!s->used || s->creator == 0){
+    release(&shm.lock);
+    return -1;
+  }
+  s->creator = 0;
+  release(&shm.lock);
+  shmput(s);
+  return 0;
+}
+
+// Drop the creation references that exiting p holds.
+void
+shmexit(struct proc *p)
+{
+  struct shmseg *s;
+
+  for(s = shm.segs; s < &shm.segs[NSHM]; s++){
+    acquire(&shm.lock);
+    if(s->used && s->creator == p->pid){
+      s->creator = 0;
+      release(&shm.lock);
+      shmput(s);
+    } else {
+      release(&shm.lock);
+    }
+  }
+}
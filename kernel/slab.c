@@ -0,0 +1,177 @@
+// Object caches for small kernel objects.
+//
+// An objcache hands out objects of one size, carved from whole
+// pages (slabs) taken from kalloc(). Each slab begins with a
+// struct slab, followed by a stack of the indices of its free
+// objects, followed by the objects. Keeping the free list in the
+// header rather than in the free objects means a free object
+// keeps the state its constructor gave it, so objfree() callers
+// must hand objects back in that state (e.g. with locks released).
+//
+// In front of the slabs, each CPU has a small magazine of free
+// objects, which objalloc() and objfree() use with interrupts
+// off and without taking the cache's lock. Objects move between
+// a magazine and the slabs OBJ_MAG/2 at a time.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "defs.h"
+#include "slab.h"
+
+struct slab {
+  struct objcache *oc;
+  struct slab *next;       // on oc->partial
+  struct slab **pprev;     // link pointing at this slab, if on oc->partial
+  int nfree;               // number of valid entries in free[]
+  ushort free[];           // indices of free objects
+};
+
+#define SLABHDR(n) ((sizeof(struct slab) + (n)*sizeof(ushort) + 7) & ~7L)
+
+void
+objcache_init(struct objcache *oc, char *name, uint size, void (*ctor)(void*))
+{
+  int n;
+
+  size = (size + 7) & ~7;
+  for(n = PGSIZE / size; n > 0 && SLABHDR(n) + n*size > PGSIZE; n--)
+    ;
+  if(n == 0)
+    panic("objcache_init: object too big");
+
+  oc->name = name;
+  oc->size = size;
+  oc->perslab = n;
+  oc->hdrsize = SLABHDR(n);
+  oc->ctor = ctor;
+  initlock(&oc->lock, "objcache");
+  oc->partial = 0;
+  oc->nslabs = 0;
+  for(int i = 0; i < NCPU; i++)
+    oc->mag[i].n = 0;
+}
+
+// Caller must hold oc->lock.
+static void
+partial_insert(struct objcache *oc, struct slab *s)
+{
+  s->next = oc->partial;
+  if(s->next)
+    s->next->pprev = &s->next;
+  s->pprev = &oc->partial;
+  oc->partial = s;
+}
+
+// Caller must hold oc->lock.
+static void
+partial_remove(struct slab *s)
+{
+  *s->pprev = s->next;
+  if(s->next)
+    s->next->pprev = s->pprev;
+  s->next = 0;
+  s->pprev = 0;
+}
+
+// Make a new slab, with every object constructed and free,
+// and put it on oc->partial. Returns 0 if out of memory.
+// Caller must hold oc->lock.
+static struct slab *
+slab_grow(struct objcache *oc)
+{
+  struct slab *s;
+
+  if((s = (struct slab *)kalloc()) == 0)
+    return 0;
+  s->oc = oc;
+  s->nfree = oc->perslab;
+  for(int i = 0; i < oc->perslab; i++){
+    s->free[i] = oc->perslab - 1 - i;
+    if(oc->ctor)
+      oc->ctor((char *)s + oc->hdrsize + i*oc->size);
+  }
+  partial_insert(oc, s);
+  oc->nslabs++;
+  return s;
+}
+
+// Move up to n objects from the slabs into magazine m.
+// Called with interrupts off.
+static void
+mag_refill(struct objcache *oc, int m, int n)
+{
+  struct slab *s;
+
+  acquire(&oc->lock);
+  while(oc->mag[m].n < n){
+    if((s = oc->partial) == 0 && (s = slab_grow(oc)) == 0)
+      break;
+    int i = s->free[--s->nfree];
+    oc->mag[m].objs[oc->mag[m].n++] = (char *)s + oc->hdrsize + i*oc->size;
+    if(s->nfree == 0)
+      partial_remove(s);
+  }
+  release(&oc->lock);
+}
+
+// Return n objects from magazine m to their slabs, freeing
+// any slab that becomes entirely free.
+// Called with interrupts off.
+static void
+mag_drain(struct objcache *oc, int m, int n)
+{
+  struct slab *s;
+  char *obj;
+
+  acquire(&oc->lock);
+  while(n-- > 0 && oc->mag[m].n > 0){
+    obj = oc->mag[m].objs[--oc->mag[m].n];
+    s = (struct slab *)PGROUNDDOWN((uint64)obj);
+    if(s->oc != oc)
+      panic("objfree: wrong cache");
+    s->free[s->nfree++] = (obj - (char *)s - oc->hdrsize) / oc->size;
+    if(s->nfree == 1)
+      partial_insert(oc, s);
+    if(s->nfree == oc->perslab){
+      partial_remove(s);
+      oc->nslabs--;
+      kfree((void *)s);
+    }
+  }
+  release(&oc->lock);
+}
+
+// Allocate an object from oc, in the state its constructor
+// left it. Returns 0 if out of memory.
+void *
+objalloc(struct objcache *oc)
+{
+  void *obj = 0;
+  int m;
+
+  push_off();
+  m = cpuid();
+  if(oc->mag[m].n == 0)
+    mag_refill(oc, m, OBJ_MAG/2);
+  if(oc->mag[m].n > 0)
+    obj = oc->mag[m].objs[--oc->mag[m].n];
+  pop_off();
+  return obj;
+}
+
+// Return an object, in its constructed state, to oc.
+void
+objfree(struct objcache *oc, void *obj)
+{
+  int m;
+
+  push_off();
+  m = cpuid();
+  if(oc->mag[m].n == OBJ_MAG)
+    mag_drain(oc, m, OBJ_MAG/2);
+  oc->mag[m].objs[oc->mag[m].n++] = obj;
+  pop_off();
+}
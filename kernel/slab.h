@@ -0,0 +1,20 @@
+// Cache of fixed-size kernel objects; see slab.c.
+#define OBJ_MAG 8  // free objects in each CPU's magazine
+
+struct objcache {
+  char *name;              // for debugging
+  uint size;               // object size, rounded up to 8 bytes
+  int perslab;             // objects per slab page
+  uint hdrsize;            // bytes of slab header before the objects
+  void (*ctor)(void*);     // run once per object, when its slab is made
+
+  struct spinlock lock;    // protects partial and nslabs
+  struct slab *partial;    // slabs with at least one free object
+  int nslabs;              // slab pages allocated
+
+  // per-CPU free objects; used with interrupts off, without lock.
+  struct {
+    int n;
+    void *objs[OBJ_MAG];
+  } mag[NCPU];
+};
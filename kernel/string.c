@@ -1,13 +1,30 @@
 #include "types.h"
 
+// memset(), memmove() and memcmp() work a 64-bit word at a
+// time, eight words per loop iteration, once they have brought
+// dst (and src) to a word boundary with single bytes. If dst and
+// src are differently aligned, no such boundary exists, and they
+// copy byte by byte: misaligned word accesses trap on RISC-V.
+
+#define WMASK (sizeof(uint64) - 1)
+
 void*
 memset(void *dst, int c, uint n)
 {
-  char *cdst = (char *) dst;
-  int i;
-  for(i = 0; i < n; i++){
-    cdst[i] = c;
+  char *d = dst;
+  uint64 w, *wd;
+
+  for(; n > 0 && ((uint64)d & WMASK); n--)
+    *d++ = c;
+  w = (uchar)c * 0x0101010101010101ULL;
+  for(wd = (uint64*)d; n >= 8*sizeof(uint64); n -= 8*sizeof(uint64), wd += 8){
+    wd[0] = w; wd[1] = w; wd[2] = w; wd[3] = w;
+    wd[4] = w; wd[5] = w; wd[6] = w; wd[7] = w;
   }
+  for(; n >= sizeof(uint64); n -= sizeof(uint64))
+    *wd++ = w;
+  for(d = (char*)wd; n > 0; n--)
+    *d++ = c;
   return dst;
 }
 
@@ -18,6 +35,14 @@ memcmp(const void *v1, const void *v2, uint n)
 
   s1 = v1;
   s2 = v2;
+  if((((uint64)s1 ^ (uint64)s2) & WMASK) == 0){
+    for(; n > 0 && ((uint64)s1 & WMASK); n--, s1++, s2++)
+      if(*s1 != *s2)
+        return *s1 - *s2;
+    // skip equal words; the loop below finds the differing byte.
+    for(; n >= sizeof(uint64) && *(uint64*)s1 == *(uint64*)s2; n -= sizeof(uint64))
+      s1 += sizeof(uint64), s2 += sizeof(uint64);
+  }
   while(n-- > 0){
     if(*s1 != *s2)
       return *s1 - *s2;
@@ -32,6 +57,8 @@ memmove(void *dst, const void *src, uint n)
 {
   const char *s;
   char *d;
+  const uint64 *ws;
+  uint64 *wd;
 
   if(n == 0)
     return dst;
@@ -39,13 +66,45 @@ memmove(void *dst, const void *src, uint n)
   s = src;
   d = dst;
   if(s < d && s + n > d){
+    // dst overlaps the end of src: copy from the end down.
     s += n;
     d += n;
+    if((((uint64)s ^ (uint64)d) & WMASK) == 0){
+      for(; n > 0 && ((uint64)d & WMASK); n--)
+        *--d = *--s;
+      ws = (const uint64*)s;
+      wd = (uint64*)d;
+      for(; n >= 8*sizeof(uint64); n -= 8*sizeof(uint64)){
+        ws -= 8;
+        wd -= 8;
+        wd[7] = ws[7]; wd[6] = ws[6]; wd[5] = ws[5]; wd[4] = ws[4];
+        wd[3] = ws[3]; wd[2] = ws[2]; wd[1] = ws[1]; wd[0] = ws[0];
+      }
+      for(; n >= sizeof(uint64); n -= sizeof(uint64))
+        *--wd = *--ws;
+      s = (const char*)ws;
+      d = (char*)wd;
+    }
     while(n-- > 0)
       *--d = *--s;
-  } else
+  } else {
+    if((((uint64)s ^ (uint64)d) & WMASK) == 0){
+      for(; n > 0 && ((uint64)d & WMASK); n--)
+        *d++ = *s++;
+      ws = (const uint64*)s;
+      wd = (uint64*)d;
+      for(; n >= 8*sizeof(uint64); n -= 8*sizeof(uint64), ws += 8, wd += 8){
+        wd[0] = ws[0]; wd[1] = ws[1]; wd[2] = ws[2]; wd[3] = ws[3];
+        wd[4] = ws[4]; wd[5] = ws[5]; wd[6] = ws[6]; wd[7] = ws[7];
+      }
+      for(; n >= sizeof(uint64); n -= sizeof(uint64))
+        *wd++ = *ws++;
+      s = (const char*)ws;
+      d = (char*)wd;
+    }
     while(n-- > 0)
       *d++ = *s++;
+  }
 
   return dst;
 }
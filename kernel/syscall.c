@@ -108,6 +108,23 @@ extern uint64 sys_getpriority(void);
 extern uint64 sys_test_acquire(void);
 extern uint64 sys_test_release(void);
 extern uint64 sys_cpu_work(void);
+extern uint64 sys_pi_acquire(void);
+extern uint64 sys_pi_release(void);
+extern uint64 sys_pi_graph(void);
+extern uint64 sys_uptime_ns(void);
+extern uint64 sys_memstat(void);
+extern uint64 sys_mmap(void);
+extern uint64 sys_munmap(void);
+extern uint64 sys_shmget(void);
+extern uint64 sys_shmat(void);
+extern uint64 sys_shmdt(void);
+extern uint64 sys_memlimit(void);
+extern uint64 sys_fcntl(void);
+extern uint64 sys_splice(void);
+extern uint64 sys_poll(void);
+extern uint64 sys_ringsetup(void);
+extern uint64 sys_ringenter(void);
+extern uint64 sys_shmrm(void);
 
 // An array mapping syscall numbers from syscall.h
 // to the function that handles the system call.
@@ -139,6 +156,23 @@ static uint64 (*syscalls[])(void) = {
 [SYS_test_acquire] sys_test_acquire,
 [SYS_test_release] sys_test_release,
 [SYS_cpu_work] sys_cpu_work,
+[SYS_pi_acquire] sys_pi_acquire,
+[SYS_pi_release] sys_pi_release,
+[SYS_pi_graph] sys_pi_graph,
+[SYS_uptime_ns] sys_uptime_ns,
+[SYS_memstat] sys_memstat,
+[SYS_mmap]    sys_mmap,
+[SYS_munmap]  sys_munmap,
+[SYS_shmget]  sys_shmget,
+[SYS_shmat]   sys_shmat,
+[SYS_shmdt]   sys_shmdt,
+[SYS_memlimit] sys_memlimit,
+[SYS_fcntl]   sys_fcntl,
+[SYS_splice]  sys_splice,
+[SYS_poll]    sys_poll,
+[SYS_ringsetup] sys_ringsetup,
+[SYS_ringenter] sys_ringenter,
+[SYS_shmrm]   sys_shmrm,
 };
 
 void
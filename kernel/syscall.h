@@ -26,3 +26,20 @@
 #define SYS_test_acquire 24
 #define SYS_test_release 25
 #define SYS_cpu_work 26
+#define SYS_pi_acquire 27
+#define SYS_pi_release 28
+#define SYS_pi_graph 29
+#define SYS_uptime_ns 30
+#define SYS_memstat 31
+#define SYS_mmap 32
+#define SYS_munmap 33
+#define SYS_shmget 34
+#define SYS_shmat 35
+#define SYS_shmdt 36
+#define SYS_memlimit 37
+#define SYS_fcntl  38
+#define SYS_splice 39
+#define SYS_poll   40
+#define SYS_ringsetup 41
+#define SYS_ringenter 42
+#define SYS_shmrm  43
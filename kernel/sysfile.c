@@ -15,6 +15,7 @@
 #include "sleeplock.h"
 #include "file.h"
 #include "fcntl.h"
+#include "mman.h"
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
@@ -76,6 +77,9 @@ sys_read(void)
   argint(2, &n);
   if(argfd(0, 0, &f) < 0)
     return -1;
+  // fileread() copies out under the pipe or inode lock.
+  if(n > 0 && vmprefault(myproc(), p, n) < 0)
+    return -1;
   return fileread(f, p, n);
 }
 
@@ -90,6 +94,9 @@ sys_write(void)
   argint(2, &n);
   if(argfd(0, 0, &f) < 0)
     return -1;
+  // filewrite() copies in under the pipe or inode lock.
+  if(n > 0 && vmprefault(myproc(), p, n) < 0)
+    return -1;
 
   return filewrite(f, p, n);
 }
@@ -359,6 +366,7 @@ sys_open(void)
   f->ip = ip;
   f->readable = !(omode & O_WRONLY);
   f->writable = (omode & O_WRONLY) || (omode & O_RDWR);
+  f->nonblock = (omode & O_NONBLOCK) != 0;
 
   if((omode & O_TRUNC) && ip->type == T_FILE){
     itrunc(ip);
@@ -503,3 +511,118 @@ sys_pipe(void)
   }
   return 0;
 }
+
+// Map a file or, with MAP_ANON, zero-filled memory into the
+// process at an address the kernel picks; see vma.c.
+uint64
+sys_mmap(void)
+{
+  uint64 addr, len;
+  int prot, flags, off, perm = 0;
+  struct file *f;
+
+  argaddr(0, &addr);
+  argaddr(1, &len);
+  argint(2, &prot);
+  argint(3, &flags);
+  argint(5, &off);
+  if(addr != 0 || off < 0)
+    return -1;
+  if(((flags & MAP_SHARED) != 0) == ((flags & MAP_PRIVATE) != 0))
+    return -1;
+  if(prot & PROT_WRITE)
+    perm |= PTE_W;
+  if(prot & PROT_EXEC)
+    perm |= PTE_X;
+
+  if(flags & MAP_ANON)
+    return vmamap(myproc(), len, perm, flags, 0, 0);
+
+  if(argfd(4, 0, &f) < 0)
+    return -1;
+  if(f->type != FD_INODE || !f->readable)
+    return -1;
+  if((flags & MAP_SHARED) && (prot & PROT_WRITE) && !f->writable)
+    return -1;
+  return vmamap(myproc(), len, perm, flags, f->ip, off);
+}
+
+uint64
+sys_munmap(void)
+{
+  uint64 addr, len;
+
+  argaddr(0, &addr);
+  argaddr(1, &len);
+  return vmaunmap(myproc(), addr, len);
+}
+
+uint64
+sys_fcntl(void)
+{
+  struct file *f;
+  int cmd, arg;
+
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  argint(1, &cmd);
+  argint(2, &arg);
+  switch(cmd){
+  case F_GETPIPE_SZ:
+    if(f->type != FD_PIPE)
+      return -1;
+    return pipegetsize(f->pipe);
+  case F_SETPIPE_SZ:
+    if(f->type != FD_PIPE || arg < 0)
+      return -1;
+    return pipesetsize(f->pipe, arg);
+  case F_GETFL:
+    return (f->writable ? (f->readable ? O_RDWR : O_WRONLY) : O_RDONLY) |
+           (f->nonblock ? O_NONBLOCK : 0);
+  case F_SETFL:
+    f->nonblock = (arg & O_NONBLOCK) != 0;
+    return 0;
+  }
+  return -1;
+}
+
+uint64
+sys_splice(void)
+{
+  struct file *in, *out;
+  int n;
+
+  if(argfd(0, 0, &in) < 0 || argfd(1, 0, &out) < 0)
+    return -1;
+  argint(2, &n);
+  if(n < 0)
+    return -1;
+  return filesplice(in, out, n);
+}
+
+uint64
+sys_poll(void)
+{
+  uint64 fds;
+  int nfds, timeout;
+
+  argaddr(0, &fds);
+  argint(1, &nfds);
+  argint(2, &timeout);
+  return kpoll(fds, nfds, timeout);
+}
+
+uint64
+sys_ringsetup(void)
+{
+  return ringsetup(myproc());
+}
+
+uint64
+sys_ringenter(void)
+{
+  int n;
+
+  argint(0, &n);
+  return ringenter(myproc(), n);
+}
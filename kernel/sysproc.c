@@ -6,6 +6,7 @@
 #include "spinlock.h"
 #include "proc.h"
 #include "vm.h"
+#include "memstat.h"
 
 uint64
 sys_exit(void)
@@ -57,7 +58,7 @@ sys_sbrk(void)
     // memory, vmfault() will allocate it.
     if(addr + n < addr)
       return -1;
-    if(addr + n > TRAPFRAME)
+    if(addr + n > vmalimit(myproc()))
       return -1;
     myproc()->sz += n;
   }
@@ -68,20 +69,24 @@ uint64
 sys_pause(void)
 {
   int n;
-  uint ticks0;
+  uint64 ticks0;
 
   argint(0, &n);
   if(n < 0)
     n = 0;
+  ticks0 = readticks();
   acquire(&tickslock);
-  ticks0 = ticks;
-  while(ticks - ticks0 < n){
+  tickwaiters++;
+  __sync_synchronize();  // pairs with the barrier in clockintr()
+  while(readticks() - ticks0 < n){
     if(killed(myproc())){
+      tickwaiters--;
       release(&tickslock);
       return -1;
     }
     sleep(&ticks, &tickslock);
   }
+  tickwaiters--;
   release(&tickslock);
   return 0;
 }
@@ -100,10 +105,95 @@ sys_kill(void)
 uint64
 sys_uptime(void)
 {
-  uint xticks;
+  return readticks();
+}
 
-  acquire(&tickslock);
-  xticks = ticks;
-  release(&tickslock);
-  return xticks;
+// return nanoseconds since boot, from the
+// monotonic RISC-V time CSR.
+uint64
+sys_uptime_ns(void)
+{
+  return r_time() * (1000000000L / TIMEBASE_FREQ);
+}
+
+// copy physical memory statistics, and this
+// process's resident page count, to the
+// struct memstat at user address addr.
+uint64
+sys_memstat(void)
+{
+  uint64 addr;
+  struct memstat st;
+
+  argaddr(0, &addr);
+  kmemstat(&st);
+  st.nused = st.npages - st.nfree;
+  st.rss = myproc()->rss;
+  st.rsslimit = myproc()->rsslimit;
+  if(copyout(myproc()->pagetable, addr, (char *)&st, sizeof(st)) < 0)
+    return -1;
+  return 0;
+}
+
+// limit this process, and children it forks from now on,
+// to npages resident pages. allocations that would exceed
+// it fail. a limit, once set or inherited, can only be
+// lowered, so that a parent can contain a child.
+uint64
+sys_memlimit(void)
+{
+  int npages;
+  struct proc *p = myproc();
+
+  argint(0, &npages);
+  if(npages <= 0)
+    return -1;
+  if(p->rsslimit && npages > p->rsslimit)
+    return -1;
+  p->rsslimit = npages;
+  return 0;
+}
+
+// return the id of the shared memory segment with
+// a key, creating it if need be.
+uint64
+sys_shmget(void)
+{
+  int key;
+  uint64 size;
+
+  argint(0, &key);
+  argaddr(1, &size);
+  return shmget(key, size);
+}
+
+// map a shared memory segment into this process.
+uint64
+sys_shmat(void)
+{
+  int id;
+
+  argint(0, &id);
+  return shmattach(myproc(), id);
+}
+
+// unmap the shared memory segment attached at addr.
+uint64
+sys_shmdt(void)
+{
+  uint64 addr;
+
+  argaddr(0, &addr);
+  return shmdetach(myproc(), addr);
+}
+
+// remove a shared memory segment's key; the segment
+// goes away when the last process detaches it.
+uint64
+sys_shmrm(void)
+{
+  int id;
+
+  argint(0, &id);
+  return shmremove(id);
 }
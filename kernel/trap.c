@@ -4,10 +4,20 @@
 #include "riscv.h"
 #include "spinlock.h"
 #include "proc.h"
+#include "waitq.h"
 #include "defs.h"
 
+// ticks is written only by hart 0 in clockintr() and is read
+// without a lock (see readticks()). tickslock is needed only by
+// processes sleeping in pause(), which tickwaiters counts so that
+// clockintr() can skip the lock and the wakeup when there are none.
 struct spinlock tickslock;
-uint ticks;
+uint64 ticks;
+int tickwaiters;                // protected by tickslock
+struct waitq tickq;             // poll()s with a timeout
+
+// published to user space at UTIME; see memlayout.h.
+struct utime *utime;
 
 extern char trampoline[], uservec[];
 
@@ -20,6 +30,10 @@ void
 trapinit(void)
 {
   initlock(&tickslock, "time");
+
+  if((utime = (struct utime *)kzalloc()) == 0)
+    panic("trapinit: utime");
+  utime->timebase = TIMEBASE_FREQ;
 }
 
 // set up to take exceptions and traps while in the kernel.
@@ -27,6 +41,10 @@ void
 trapinithart(void)
 {
   w_stvec((uint64)kernelvec);
+
+  // let user code read the time CSR, so that it can
+  // compute the time from UTIME's timebase.
+  w_scounteren(r_scounteren() | 2);
 }
 
 //
@@ -68,9 +86,9 @@ usertrap(void)
     syscall();
   } else if((which_dev = devintr()) != 0){
     // ok
-  } else if((r_scause() == 15 || r_scause() == 13) &&
-            vmfault(p->pagetable, r_stval(), (r_scause() == 13)? 1 : 0) != 0) {
-    // page fault on lazily-allocated page
+  } else if((r_scause() == 15 || r_scause() == 13 || r_scause() == 12) &&
+            vmfault(p->pagetable, r_stval(), (r_scause() != 15)? 1 : 0) != 0) {
+    // page fault on lazily-allocated, file-backed or copy-on-write page
   } else {
     printf("usertrap(): unexpected scause 0x%lx pid=%d\n", r_scause(), p->pid);
     printf("            sepc=0x%lx stval=0x%lx\n", r_sepc(), r_stval());
@@ -161,20 +179,36 @@ kerneltrap()
   w_sstatus(sstatus);
 }
 
+// Return the number of clock ticks since boot.
+// ticks is a naturally aligned 64-bit word, so a single load
+// sees a consistent value and readers never need tickslock.
+uint64
+readticks(void)
+{
+  return __atomic_load_n(&ticks, __ATOMIC_RELAXED);
+}
+
 void
 clockintr()
 {
   if(cpuid() == 0){
-    acquire(&tickslock);
-    ticks++;
-    wakeup(&ticks);
-    release(&tickslock);
+    __atomic_store_n(&ticks, ticks + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&utime->ticks, ticks, __ATOMIC_RELAXED);
+
+    // pairs with the barrier in sys_pause(): either we see its
+    // tickwaiters increment, or it sees the new ticks.
+    __sync_synchronize();
+    if(__atomic_load_n(&tickwaiters, __ATOMIC_RELAXED)){
+      acquire(&tickslock);
+      wakeup(&ticks);
+      release(&tickslock);
+    }
+    waitqwake(&tickq);
   }
 
   // ask for the next timer interrupt. this also clears
-  // the interrupt request. 1000000 is about a tenth
-  // of a second.
-  w_stimecmp(r_time() + 1000000);
+  // the interrupt request.
+  w_stimecmp(r_time() + TICKCYCLES);
 }
 
 // check if it's an external interrupt or software interrupt,
@@ -17,14 +17,17 @@ extern char etext[];  // kernel.ld sets this to end of kernel code.
 
 extern char trampoline[]; // trampoline.S
 
+// a page of zeroes, mapped read-only and copy-on-write
+// wherever lazily-allocated memory is read before written.
+static char *zeropage;
+
 // Make a direct-map page table for the kernel.
 pagetable_t
 kvmmake(void)
 {
   pagetable_t kpgtbl;
 
-  kpgtbl = (pagetable_t) kalloc();
-  memset(kpgtbl, 0, PGSIZE);
+  kpgtbl = (pagetable_t) kzalloc();
 
   // uart registers
   kvmmap(kpgtbl, UART0, UART0, PGSIZE, PTE_R | PTE_W);
@@ -66,6 +69,8 @@ void
 kvminit(void)
 {
   kernel_pagetable = kvmmake();
+  if((zeropage = kzalloc()) == 0)
+    panic("kvminit");
 }
 
 // Switch the current CPU's h/w page table register to
@@ -84,7 +89,8 @@ kvminithart()
 
 // Return the address of the PTE in page table pagetable
 // that corresponds to virtual address va.  If alloc!=0,
-// create any required page-table pages.
+// create any required page-table pages. If va lies in a
+// 2MB megapage, return its level-1 PTE, which has PTE_S set.
 //
 // The risc-v Sv39 scheme has three levels of page-table
 // pages. A page-table page contains 512 64-bit PTEs.
@@ -103,17 +109,63 @@ walk(pagetable_t pagetable, uint64 va, int alloc)
   for(int level = 2; level > 0; level--) {
     pte_t *pte = &pagetable[PX(level, va)];
     if(*pte & PTE_V) {
+      if(*pte & PTE_S)
+        return pte;
       pagetable = (pagetable_t)PTE2PA(*pte);
     } else {
-      if(!alloc || (pagetable = (pde_t*)kalloc()) == 0)
+      if(!alloc || (pagetable = (pde_t*)kzalloc()) == 0)
         return 0;
-      memset(pagetable, 0, PGSIZE);
       *pte = PA2PTE(pagetable) | PTE_V;
     }
   }
   return &pagetable[PX(0, va)];
 }
 
+// Return the address of the level-1 PTE for va, which maps
+// either a level-0 page-table page or a megapage.
+static pte_t *
+walk1(pagetable_t pagetable, uint64 va, int alloc)
+{
+  pte_t *pte = &pagetable[PX(2, va)];
+
+  if(*pte & PTE_V) {
+    pagetable = (pagetable_t)PTE2PA(*pte);
+  } else {
+    if(!alloc || (pagetable = (pde_t*)kzalloc()) == 0)
+      return 0;
+    *pte = PA2PTE(pagetable) | PTE_V;
+  }
+  return &pagetable[PX(1, va)];
+}
+
+// Replace the megapage containing va with a level-0 page
+// table mapping the same memory with 4KB pages, each of
+// which can then be freed on its own.
+// Returns 0 on success, -1 if out of memory.
+static int
+demote(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte = walk1(pagetable, va, 0);
+  pagetable_t l0;
+  uint64 pa;
+  int perm;
+
+  if(pte == 0 || (*pte & PTE_S) == 0)
+    panic("demote");
+  if((l0 = (pagetable_t)kzalloc()) == 0)
+    return -1;
+  pa = PTE2PA(*pte);
+  perm = PTE_FLAGS(*pte) & ~PTE_S;
+  for(int i = 0; i < 512; i++)
+    l0[i] = PA2PTE(pa + i*PGSIZE) | perm;
+  if(perm & PTE_U)
+    ksplit((void*)pa, SUPERPGORDER);
+  *pte = PA2PTE(l0) | PTE_V;
+  // a user page table's stale TLB entries are flushed on the
+  // way back to user space; the kernel's megapages never split.
+  return 0;
+}
+
 // Look up a virtual address, return the physical address,
 // or 0 if not mapped.
 // Can only be used to look up user pages.
@@ -134,18 +186,46 @@ walkaddr(pagetable_t pagetable, uint64 va)
   if((*pte & PTE_U) == 0)
     return 0;
   pa = PTE2PA(*pte);
+  if(*pte & PTE_S)
+    pa += PGROUNDDOWN(va) & (SUPERPGSIZE-1);
   return pa;
 }
 
+// Count n pages into (or, if negative, out of) the resident set
+// of the current process, if pagetable is its page table.
+// fork() and exec() set the count for a page table they build.
+void
+rssadd(pagetable_t pagetable, int n)
+{
+  struct proc *p = myproc();
+
+  if(p && p->pagetable == pagetable)
+    p->rss += n;
+}
+
+// Return 1 if n more resident pages in pagetable would keep
+// the current process within its rsslimit, else 0.
+int
+rssok(pagetable_t pagetable, int n)
+{
+  struct proc *p = myproc();
+
+  if(p == 0 || p->pagetable != pagetable || p->rsslimit == 0)
+    return 1;
+  return p->rss + n <= p->rsslimit;
+}
+
 // Create PTEs for virtual addresses starting at va that refer to
 // physical addresses starting at pa.
 // va and size MUST be page-aligned.
+// Uses a 2MB megapage wherever va and pa are 2MB-aligned, at
+// least 2MB remain, and no 4KB mappings already share the range.
 // Returns 0 on success, -1 if walk() couldn't
 // allocate a needed page-table page.
 int
 mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
 {
-  uint64 a, last;
+  uint64 a, end;
   pte_t *pte;
 
   if((va % PGSIZE) != 0)
@@ -158,15 +238,23 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
     panic("mappages: size");
   
   a = va;
-  last = va + size - PGSIZE;
-  for(;;){
+  end = va + size;
+  while(a < end){
+    if(a % SUPERPGSIZE == 0 && pa % SUPERPGSIZE == 0 && end - a >= SUPERPGSIZE){
+      if((pte = walk1(pagetable, a, 1)) == 0)
+        return -1;
+      if(*pte == 0){
+        *pte = PA2PTE(pa) | perm | PTE_S | PTE_V;
+        a += SUPERPGSIZE;
+        pa += SUPERPGSIZE;
+        continue;
+      }
+    }
     if((pte = walk(pagetable, a, 1)) == 0)
       return -1;
     if(*pte & PTE_V)
       panic("mappages: remap");
     *pte = PA2PTE(pa) | perm | PTE_V;
-    if(a == last)
-      break;
     a += PGSIZE;
     pa += PGSIZE;
   }
@@ -179,36 +267,52 @@ pagetable_t
 uvmcreate()
 {
   pagetable_t pagetable;
-  pagetable = (pagetable_t) kalloc();
-  if(pagetable == 0)
-    return 0;
-  memset(pagetable, 0, PGSIZE);
+  pagetable = (pagetable_t) kzalloc();
   return pagetable;
 }
 
 // Remove npages of mappings starting from va. va must be
 // page-aligned. It's OK if the mappings don't exist.
 // Optionally free the physical memory.
+// A megapage only partly in the range is first split.
 void
 uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
 {
-  uint64 a;
+  uint64 a, end = va + npages*PGSIZE;
   pte_t *pte;
+  int n = 0;
 
   if((va % PGSIZE) != 0)
     panic("uvmunmap: not aligned");
 
-  for(a = va; a < va + npages*PGSIZE; a += PGSIZE){
+  for(a = va; a < end; a += PGSIZE){
     if((pte = walk(pagetable, a, 0)) == 0) // leaf page table entry allocated?
       continue;   
     if((*pte & PTE_V) == 0)  // has physical page been allocated?
       continue;
+    if(*pte & PTE_S){
+      if(a % SUPERPGSIZE == 0 && end - a >= SUPERPGSIZE){
+        if(do_free){
+          kfree_order((void*)PTE2PA(*pte), SUPERPGORDER);
+          n += 1 << SUPERPGORDER;
+        }
+        *pte = 0;
+        a += SUPERPGSIZE - PGSIZE;
+        continue;
+      }
+      if(demote(pagetable, a) < 0)
+        panic("uvmunmap: demote");
+      pte = walk(pagetable, a, 0);
+    }
     if(do_free){
       uint64 pa = PTE2PA(*pte);
+      if(pa != (uint64)zeropage)
+        n++;
       kfree((void*)pa);
     }
     *pte = 0;
   }
+  rssadd(pagetable, -n);
 }
 
 // Allocate PTEs and physical memory to grow a process from oldsz to
@@ -218,23 +322,39 @@ uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz, int xperm)
 {
   char *mem;
   uint64 a;
+  pte_t *pte;
 
   if(newsz < oldsz)
     return oldsz;
 
   oldsz = PGROUNDUP(oldsz);
   for(a = oldsz; a < newsz; a += PGSIZE){
-    mem = kalloc();
+    // a whole, aligned 2MB gets a megapage if one is free.
+    if(a % SUPERPGSIZE == 0 && newsz - a >= SUPERPGSIZE &&
+       rssok(pagetable, 1 << SUPERPGORDER) &&
+       (pte = walk1(pagetable, a, 1)) != 0 && *pte == 0 &&
+       (mem = kalloc_order(SUPERPGORDER)) != 0){
+      memset(mem, 0, SUPERPGSIZE);
+      *pte = PA2PTE(mem) | PTE_R | PTE_U | xperm | PTE_S | PTE_V;
+      rssadd(pagetable, 1 << SUPERPGORDER);
+      a += SUPERPGSIZE - PGSIZE;
+      continue;
+    }
+    if(!rssok(pagetable, 1)){
+      uvmdealloc(pagetable, a, oldsz);
+      return 0;
+    }
+    mem = kzalloc();
     if(mem == 0){
       uvmdealloc(pagetable, a, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
     if(mappages(pagetable, a, PGSIZE, (uint64)mem, PTE_R|PTE_U|xperm) != 0){
       kfree(mem);
       uvmdealloc(pagetable, a, oldsz);
       return 0;
     }
+    rssadd(pagetable, 1);
   }
   return newsz;
 }
@@ -289,37 +409,55 @@ uvmfree(pagetable_t pagetable, uint64 sz)
 
 // Given a parent process's page table, copy
 // its memory into a child's page table.
-// Copies both the page table and the
-// physical memory.
+// Copies the page table but shares the physical
+// memory: writable pages become read-only and
+// copy-on-write in both parent and child, and
+// vmfault() copies them when either writes.
 // returns 0 on success, -1 on failure.
 // frees any allocated pages on failure.
 int
 uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
+{
+  return uvmshare(old, new, 0, sz, 1);
+}
+
+// Map the pages of old in [start, end) into new at the same
+// addresses. If cow, writable pages become copy-on-write in
+// both page tables; otherwise both share them writable.
+// returns 0 on success, -1 on failure.
+// unmaps any pages it mapped in new on failure.
+int
+uvmshare(pagetable_t old, pagetable_t new, uint64 start, uint64 end, int cow)
 {
   pte_t *pte;
   uint64 pa, i;
   uint flags;
-  char *mem;
 
-  for(i = 0; i < sz; i += PGSIZE){
+  for(i = start; i < end; i += PGSIZE){
     if((pte = walk(old, i, 0)) == 0)
       continue;   // page table entry hasn't been allocated
     if((*pte & PTE_V) == 0)
       continue;   // physical page hasn't been allocated
+    if(*pte & PTE_S){
+      // share 4KB pages, so that copy-on-write copies 4KB.
+      if(demote(old, i) < 0)
+        goto err;
+      pte = walk(old, i, 0);
+    }
+    if(cow && (*pte & PTE_W))
+      *pte = (*pte & ~PTE_W) | PTE_COW;
     pa = PTE2PA(*pte);
     flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
+    if(mappages(new, i, PGSIZE, pa, flags) != 0)
       goto err;
-    memmove(mem, (char*)pa, PGSIZE);
-    if(mappages(new, i, PGSIZE, (uint64)mem, flags) != 0){
-      kfree(mem);
-      goto err;
-    }
+    krefpage((void*)pa);
   }
+  // the parent's stale writable TLB entries are flushed
+  // by userret in trampoline.S on its way back to user space.
   return 0;
 
  err:
-  uvmunmap(new, 0, i / PGSIZE, 1);
+  uvmunmap(new, start, (i - start) / PGSIZE, 1);
   return -1;
 }
 
@@ -358,6 +496,11 @@ copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
     }
 
     pte = walk(pagetable, va0, 0);
+    // give this process its own copy of a shared page.
+    if(*pte & PTE_COW){
+      if((pa0 = cowfault(pagetable, va0)) == 0)
+        return -1;
+    }
     // forbid copyout over read-only user text pages.
     if((*pte & PTE_W) == 0)
       return -1;
@@ -386,7 +529,7 @@ copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
     va0 = PGROUNDDOWN(srcva);
     pa0 = walkaddr(pagetable, va0);
     if(pa0 == 0) {
-      if((pa0 = vmfault(pagetable, va0, 0)) == 0) {
+      if((pa0 = vmfault(pagetable, va0, 1)) == 0) {
         return -1;
       }
     }
@@ -415,8 +558,11 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
   while(got_null == 0 && max > 0){
     va0 = PGROUNDDOWN(srcva);
     pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
-      return -1;
+    if(pa0 == 0) {
+      if((pa0 = vmfault(pagetable, va0, 1)) == 0) {
+        return -1;
+      }
+    }
     n = PGSIZE - (srcva - va0);
     if(n > max)
       n = max;
@@ -445,30 +591,87 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
   }
 }
 
+// Make the copy-on-write page at va in pagetable writable,
+// copying it first if another page table still shares it.
+// returns the physical address of the now-private page,
+// or 0 if out of physical memory.
+uint64
+cowfault(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+  uint64 pa;
+  char *mem;
+
+  pte = walk(pagetable, va, 0);
+  if(pte == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_COW) == 0)
+    return 0;
+  pa = PTE2PA(*pte);
+
+  if(krefcount((void*)pa) == 1){
+    // every other sharer has already copied or exited.
+    *pte = (*pte & ~PTE_COW) | PTE_W;
+    return pa;
+  }
+
+  if(pa == (uint64)zeropage){
+    // the zero page was not counted as resident.
+    if(!rssok(pagetable, 1) || (mem = kzalloc()) == 0)
+      return 0;
+    rssadd(pagetable, 1);
+  } else {
+    if((mem = kalloc()) == 0)
+      return 0;
+    memmove(mem, (char*)pa, PGSIZE);
+  }
+  *pte = PA2PTE(mem) | ((PTE_FLAGS(*pte) & ~PTE_COW) | PTE_W);
+  kfree((void*)pa);
+  return (uint64)mem;
+}
+
 // allocate and map user memory if process is referencing a page
-// that was lazily allocated in sys_sbrk().
+// that was lazily allocated in sys_sbrk() (just the shared zero
+// page if it is reading), read in a page of a
+// vma (see vma.c), or copy a copy-on-write page that the
+// process is writing to.
 // returns 0 if va is invalid or already mapped, or if
 // out of physical memory, and physical address if successful.
 uint64
 vmfault(pagetable_t pagetable, uint64 va, int read)
 {
   uint64 mem;
+  pte_t *pte;
+  struct vma *v;
   struct proc *p = myproc();
 
-  if (va >= p->sz)
+  if (va >= USERTOP)
     return 0;
   va = PGROUNDDOWN(va);
-  if(ismapped(pagetable, va)) {
+  if((pte = walk(pagetable, va, 0)) != 0 && (*pte & PTE_V)) {
+    if(!read && (*pte & PTE_COW))
+      return cowfault(pagetable, va);
     return 0;
   }
-  mem = (uint64) kalloc();
+  if((v = vmalookup(p, va)) != 0)
+    return vmafault(pagetable, v, va);
+  if (va >= p->sz)
+    return 0;
+  if(read){
+    // share the zero page until the process writes.
+    if(mappages(pagetable, va, PGSIZE, (uint64)zeropage, PTE_COW|PTE_U|PTE_R) != 0)
+      return 0;
+    krefpage(zeropage);
+    return (uint64)zeropage;
+  }
+  if(!rssok(pagetable, 1))
+    return 0;
+  mem = (uint64) kzalloc();
   if(mem == 0)
     return 0;
-  memset((void *) mem, 0, PGSIZE);
   if (mappages(p->pagetable, va, PGSIZE, mem, PTE_W|PTE_U|PTE_R) != 0) {
     kfree((void *)mem);
     return 0;
   }
+  rssadd(pagetable, 1);
   return mem;
 }
 
@@ -0,0 +1,396 @@
+// Memory regions (vmas) whose pages vmfault() fills in on
+// first touch: the ELF segments exec() maps from the program
+// file, and mmap()ed files and anonymous memory.
+//
+// A process's vmas live in p->vma[] and are private to it.
+// exec()'s segments lie below p->sz; mmap() places regions
+// top-down below USERTOP, and sbrk() may not grow into them.
+// There is no page cache, so each process reads its own copy
+// of a file page. MAP_SHARED pages are shared with children
+// and written back to the file on munmap(), exit() and exec().
+// Shared memory segments (shm.c) are MAP_SHARED vmas too.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "mman.h"
+#include "defs.h"
+
+// pages vmafault() reads in per fault, if they are not yet mapped.
+#define READAHEAD 4
+
+// Return the vma of p that contains va, or 0.
+struct vma*
+vmalookup(struct proc *p, uint64 va)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->used && va >= v->start && va < v->end)
+      return v;
+  return 0;
+}
+
+// Fill in the page at va of v. For a file, also read up to
+// READAHEAD-1 unmapped pages after it. Reading a file sleeps,
+// so the caller must not hold a spinlock or v->ip's lock;
+// vmafault() fails rather than sleep under a spinlock, as when
+// copyout() under a pipe's lock meets a page vmprefault() missed.
+// returns the physical address of the page at va, or 0.
+uint64
+vmafault(pagetable_t pagetable, struct vma *v, uint64 va)
+{
+  uint64 a, n, first = 0;
+  char *mem;
+  int locked;
+
+  if(!rssok(pagetable, 1))
+    return 0;
+
+  if(v->shm){
+    mem = shmpage(v->shm, v->off + (va - v->start));
+    if(mappages(pagetable, va, PGSIZE, (uint64)mem, PTE_R | PTE_U | v->perm) != 0)
+      return 0;
+    krefpage(mem);
+    rssadd(pagetable, 1);
+    return (uint64)mem;
+  }
+
+  if(v->ip == 0){
+    if((mem = kzalloc()) == 0)
+      return 0;
+    if(mappages(pagetable, va, PGSIZE, (uint64)mem, PTE_R | PTE_U | v->perm) != 0){
+      kfree(mem);
+      return 0;
+    }
+    rssadd(pagetable, 1);
+    return (uint64)mem;
+  }
+
+  push_off();
+  locked = mycpu()->noff > 1;
+  pop_off();
+  if(locked)
+    return 0;
+
+  ilock(v->ip);
+  for(a = va; a < v->end && a < va + READAHEAD*PGSIZE; a += PGSIZE){
+    if(a != va && (ismapped(pagetable, a) || !rssok(pagetable, 1)))
+      break;
+    if((mem = kzalloc()) == 0)
+      break;
+    if(a < v->start + v->filesz){
+      n = v->start + v->filesz - a;
+      if(n > PGSIZE)
+        n = PGSIZE;
+      if(readi(v->ip, 0, (uint64)mem, v->off + (a - v->start), n) != n){
+        kfree(mem);
+        break;
+      }
+    }
+    if(mappages(pagetable, a, PGSIZE, (uint64)mem, PTE_R | PTE_U | v->perm) != 0){
+      kfree(mem);
+      break;
+    }
+    rssadd(pagetable, 1);
+    if(a == va)
+      first = (uint64)mem;
+  }
+  iunlock(v->ip);
+  return first;
+}
+
+// Fill in the not-yet-mapped vma pages of p in [va, va+len),
+// so that the caller can then copy to or from them while
+// holding a lock that vmafault() must not sleep under.
+// returns 0, or -1 if a page could not be filled in, in
+// which case the caller must fail rather than copy.
+int
+vmprefault(struct proc *p, uint64 va, uint64 len)
+{
+  struct vma *v;
+  uint64 a, end;
+
+  if(va + len < va)
+    return -1;
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(!v->used)
+      continue;
+    a = PGROUNDDOWN(va) > v->start ? PGROUNDDOWN(va) : v->start;
+    end = va + len < v->end ? va + len : v->end;
+    for(; a < end; a += PGSIZE)
+      if(!ismapped(p->pagetable, a) && vmafault(p->pagetable, v, a) == 0)
+        return -1;
+  }
+  return 0;
+}
+
+// Fill in every page of p's MAP_SHARED vmas. fork() calls
+// this first, since a child shares only the pages that exist.
+void
+vmapopulate(struct proc *p)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->used && (v->flags & MAP_SHARED) && !(v->flags & VMA_RING))
+      vmprefault(p, v->start, v->end - v->start);
+}
+
+// Give np copies of p's vmas, sharing the pages of MAP_SHARED
+// ones and mapping the rest copy-on-write, except for the ring,
+// which stays p's alone. Called by fork() after uvmcopy(),
+// which has already copied exec()'s segments.
+// returns 0 on success, -1 on failure.
+int
+vmafork(struct proc *p, struct proc *np)
+{
+  struct vma *v;
+  int i, j;
+
+  for(i = 0; i < NVMA; i++){
+    v = &p->vma[i];
+    if(!v->used || v->start < p->sz || (v->flags & VMA_RING))
+      continue;
+    if(uvmshare(p->pagetable, np->pagetable, v->start, PGROUNDUP(v->end),
+                (v->flags & MAP_SHARED) == 0) < 0)
+      goto err;
+  }
+
+  for(i = 0; i < NVMA; i++){
+    np->vma[i] = p->vma[i];
+    if(np->vma[i].flags & VMA_RING)
+      np->vma[i].used = 0;
+    if(np->vma[i].used && np->vma[i].ip)
+      idup(np->vma[i].ip);
+    if(np->vma[i].used && np->vma[i].shm)
+      shmdup(np->vma[i].shm);
+  }
+  return 0;
+
+ err:
+  for(j = 0; j < i; j++){
+    v = &p->vma[j];
+    if(v->used && v->start >= p->sz && !(v->flags & VMA_RING))
+      uvmunmap(np->pagetable, v->start, (PGROUNDUP(v->end) - v->start) / PGSIZE, 1);
+  }
+  return -1;
+}
+
+// Forget the parts of p's vmas at or above newsz, after
+// sbrk() has shrunk the process from oldsz to newsz.
+void
+vmatrim(struct proc *p, uint64 oldsz, uint64 newsz)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(!v->used || v->start >= oldsz || v->end <= newsz)
+      continue;
+    v->end = newsz > v->start ? newsz : v->start;
+    if(v->start + v->filesz > v->end)
+      v->filesz = v->end - v->start;
+  }
+}
+
+// Return how far sbrk() may grow p: the start of its
+// lowest mmap() region, or USERTOP.
+uint64
+vmalimit(struct proc *p)
+{
+  struct vma *v;
+  uint64 limit = USERTOP;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->used && v->start >= p->sz && v->start < limit)
+      limit = v->start;
+  return limit;
+}
+
+// Write the mapped pages of v in [lo, hi) back to its file,
+// if v is a writable MAP_SHARED file mapping. Writes stop at
+// the file's size when it was mapped; they never extend it.
+static void
+vmawriteback(pagetable_t pagetable, struct vma *v, uint64 lo, uint64 hi)
+{
+  // a few blocks per transaction, as in filewrite().
+  int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+  uint64 a, pa, n, i, n1;
+
+  if(v->ip == 0 || (v->flags & MAP_SHARED) == 0 || (v->perm & PTE_W) == 0)
+    return;
+  for(a = lo; a < hi && a < v->start + v->filesz; a += PGSIZE){
+    if((pa = walkaddr(pagetable, a)) == 0)
+      continue;
+    n = v->start + v->filesz - a;
+    if(n > PGSIZE)
+      n = PGSIZE;
+    for(i = 0; i < n; i += n1){
+      n1 = n - i;
+      if(n1 > max)
+        n1 = max;
+      begin_op();
+      ilock(v->ip);
+      writei(v->ip, 0, pa + i, v->off + (a - v->start) + i, n1);
+      iunlock(v->ip);
+      end_op();
+    }
+  }
+}
+
+// Drop a vma's file or segment reference and mark it unused.
+static void
+vmaput(struct vma *v)
+{
+  if(v->ip){
+    begin_op();
+    iput(v->ip);
+    end_op();
+  }
+  if(v->shm)
+    shmput(v->shm);
+  v->used = 0;
+}
+
+// Release an array of NVMA vmas: write back and unmap their
+// pages from pagetable, unless pagetable is 0 because none of
+// them are mapped, then drop their file references.
+void
+vmarelease(pagetable_t pagetable, struct vma *vma)
+{
+  struct vma *v;
+
+  for(v = vma; v < &vma[NVMA]; v++){
+    if(!v->used)
+      continue;
+    if(pagetable){
+      vmawriteback(pagetable, v, v->start, PGROUNDUP(v->end));
+      uvmunmap(pagetable, v->start, (PGROUNDUP(v->end) - v->start) / PGSIZE, 1);
+    }
+    vmaput(v);
+  }
+}
+
+// Map len bytes of ip from file offset off (or zero-filled
+// memory if ip is 0) into p, at an address of its choosing.
+// off must be page-aligned. perm holds PTE_W and PTE_X bits.
+// returns the address, or -1.
+uint64
+vmamap(struct proc *p, uint64 len, int perm, int flags, struct inode *ip, uint off)
+{
+  struct vma *v, *w;
+  uint64 start, end;
+  uint size = 0;
+
+  len = PGROUNDUP(len);
+  if(len == 0 || len > USERTOP || off % PGSIZE != 0)
+    return -1;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(!v->used)
+      break;
+  if(v == &p->vma[NVMA])
+    return -1;
+
+  // highest gap of len bytes below USERTOP.
+  end = USERTOP;
+ again:
+  if(end < len || end - len < PGROUNDUP(p->sz))
+    return -1;
+  start = end - len;
+  for(w = p->vma; w < &p->vma[NVMA]; w++){
+    if(w->used && w->start < end && PGROUNDUP(w->end) > start){
+      end = w->start;
+      goto again;
+    }
+  }
+
+  if(ip){
+    ilock(ip);
+    size = ip->size;
+    iunlock(ip);
+    idup(ip);
+  }
+  v->used = 1;
+  v->start = start;
+  v->end = start + len;
+  v->perm = perm;
+  v->flags = flags;
+  v->ip = ip;
+  v->shm = 0;
+  v->off = off;
+  v->filesz = 0;
+  if(size > off)
+    v->filesz = size - off < len ? size - off : len;
+  return start;
+}
+
+// Unmap p's vma pages in [va, va+len), writing back
+// MAP_SHARED ones, and shrink or split the vmas to match.
+// va must be page-aligned.
+// returns 0 on success, -1 on failure.
+int
+vmaunmap(struct proc *p, uint64 va, uint64 len)
+{
+  struct vma *v, *nv;
+  uint64 lo, hi, end;
+
+  if(va % PGSIZE != 0 || len == 0 || va + len < va)
+    return -1;
+  end = PGROUNDUP(va + len);
+
+  // splitting a vma in two needs a free slot; check first.
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->used && va > v->start && end < PGROUNDUP(v->end)){
+      for(nv = p->vma; nv < &p->vma[NVMA]; nv++)
+        if(!nv->used)
+          break;
+      if(nv == &p->vma[NVMA])
+        return -1;
+    }
+  }
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(!v->used || end <= v->start || va >= PGROUNDUP(v->end))
+      continue;
+    lo = va > v->start ? va : v->start;
+    hi = end < PGROUNDUP(v->end) ? end : PGROUNDUP(v->end);
+    if(v->flags & VMA_RING)
+      p->ring = 0;  // even in part, it is no longer a ring
+    vmawriteback(p->pagetable, v, lo, hi);
+    uvmunmap(p->pagetable, lo, (hi - lo) / PGSIZE, 1);
+
+    if(lo == v->start && hi == PGROUNDUP(v->end)){
+      vmaput(v);
+    } else if(lo == v->start){
+      v->filesz = v->filesz > hi - v->start ? v->filesz - (hi - v->start) : 0;
+      v->off += hi - v->start;
+      v->start = hi;
+    } else {
+      if(hi < PGROUNDUP(v->end)){
+        // keep [hi, end) in a new vma.
+        for(nv = p->vma; nv < &p->vma[NVMA]; nv++)
+          if(!nv->used)
+            break;
+        *nv = *v;
+        nv->start = hi;
+        nv->off = v->off + (hi - v->start);
+        nv->filesz = v->filesz > hi - v->start ? v->filesz - (hi - v->start) : 0;
+        if(nv->ip)
+          idup(nv->ip);
+        if(nv->shm)
+          shmdup(nv->shm);
+      }
+      v->end = lo;
+      if(v->filesz > lo - v->start)
+        v->filesz = lo - v->start;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,14 @@
+// A wait queue lists the poll() calls waiting on an object:
+// a pipe, the console, or the clock. Each entry stands for
+// one fd of one poll() call. polllock (poll.c) protects the
+// lists and the woken flags.
+struct pollwait {
+  struct pollwait *next;
+  struct waitq *q;   // queue this entry is on, or 0
+  void *chan;        // the poll() call's sleep channel
+  int woken;         // q was woken since poll() last looked
+};
+
+struct waitq {
+  struct pollwait *head;
+};
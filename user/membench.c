@@ -0,0 +1,104 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+// Time memmove(), memset() and memcmp() against byte-at-a-time
+// loops, for a few sizes, aligned and misaligned.
+// usage: membench [total megabytes per run]
+
+#define MAXSZ 65536
+
+static char src[MAXSZ + 8];
+static char dst[MAXSZ + 8];
+
+static void
+bytemove(char *d, const char *s, uint n)
+{
+  while(n-- > 0)
+    *d++ = *s++;
+}
+
+static void
+byteset(char *d, int c, uint n)
+{
+  while(n-- > 0)
+    *d++ = c;
+}
+
+static int
+bytecmp(const char *p, const char *q, uint n)
+{
+  for(; n > 0; n--, p++, q++)
+    if(*p != *q)
+      return (uchar)*p - (uchar)*q;
+  return 0;
+}
+
+enum { MOVE, SET, CMP };
+
+// Return the MB/s of op on n-byte buffers over total bytes,
+// using the library routine if lib, else the byte loop.
+static uint64
+run(int op, int lib, uint n, int misalign, uint64 total)
+{
+  char *d = dst + misalign, *s = src;
+  uint64 i, iters = total / n, t0, ns;
+  volatile int sink = 0;
+
+  t0 = uptime_ns();
+  for(i = 0; i < iters; i++){
+    switch(op){
+    case MOVE:
+      if(lib)
+        memmove(d, s, n);
+      else
+        bytemove(d, s, n);
+      break;
+    case SET:
+      if(lib)
+        memset(d, i, n);
+      else
+        byteset(d, i, n);
+      break;
+    case CMP:
+      sink += lib ? memcmp(d, s, n) : bytecmp(d, s, n);
+      break;
+    }
+  }
+  ns = uptime_ns() - t0;
+  if(ns == 0)
+    ns = 1;
+  return iters * n * 1000 / ns;
+}
+
+int
+main(int argc, char *argv[])
+{
+  static uint sizes[] = { 16, 256, 4096, MAXSZ };
+  static char *names[] = { "memmove", "memset", "memcmp" };
+  uint64 total = 16 << 20;
+  int op, i, misalign;
+
+  if(argc > 1)
+    total = (uint64)atoi(argv[1]) << 20;
+  if(total == 0){
+    fprintf(2, "usage: membench [megabytes]\n");
+    exit(1);
+  }
+  memset(src, 'x', sizeof(src));
+  memset(dst, 'x', sizeof(dst));
+
+  printf("op      size    align  bytes MB/s  words MB/s\n");
+  for(op = MOVE; op <= CMP; op++){
+    memmove(dst, src, sizeof(dst));  // equal, so memcmp() reads it all
+    for(i = 0; i < sizeof(sizes)/sizeof(sizes[0]); i++){
+      for(misalign = 0; misalign <= 3; misalign += 3){
+        printf("%s %d\t%s\t%ld\t%ld\n", names[op], sizes[i],
+               misalign ? "no" : "yes",
+               run(op, 0, sizes[i], misalign, total),
+               run(op, 1, sizes[i], misalign, total));
+      }
+    }
+  }
+  exit(0);
+}
@@ -0,0 +1,34 @@
+// Print physical memory statistics, including how
+// fragmented the kernel's buddy allocator is.
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/memstat.h"
+#include "user/user.h"
+
+int
+main(void)
+{
+  struct memstat st;
+  int largest = -1;
+
+  if(memstat(&st) < 0){
+    fprintf(2, "memstat: failed\n");
+    exit(1);
+  }
+
+  printf("pages: %lu total, %lu used, %lu free (%lu in per-cpu caches, %lu pre-zeroed)\n",
+         st.npages, st.nused, st.nfree, st.ncached, st.nzero);
+  printf("this process: %lu resident", st.rss);
+  if(st.rsslimit)
+    printf(", limit %lu", st.rsslimit);
+  printf("\n");
+  printf("order  pages  free blocks\n");
+  for(int k = 0; k <= MAXORDER; k++){
+    printf("%d\t%d\t%lu\n", k, 1 << k, st.nblocks[k]);
+    if(st.nblocks[k])
+      largest = k;
+  }
+  if(largest >= 0)
+    printf("largest free block: %d pages\n", 1 << largest);
+  exit(0);
+}
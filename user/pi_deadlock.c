@@ -0,0 +1,71 @@
+// user/pi_deadlock.c
+// Two processes take PI locks 0 and 1 in opposite orders.
+// The kernel should refuse the acquire that closes the cycle
+// with PI_EDEADLK, instead of letting both sleep forever.
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/pi.h"
+#include "user/user.h"
+
+static void
+locker(int first, int second, int delay)
+{
+  int r;
+
+  if(pi_acquire(first) < 0) {
+    printf("pi_deadlock: pi_acquire(%d) failed\n", first);
+    exit(1);
+  }
+  pause(delay);
+  r = pi_acquire(second);
+  if(r == 0)
+    pi_release(second);
+  pi_release(first);
+  exit(r == PI_EDEADLK ? 2 : 0);
+}
+
+static void
+dumpgraph(void)
+{
+  struct pi_edge edges[16];
+  int n;
+
+  n = pi_graph(edges, 16);
+  printf("wait-for graph: %d edge(s)\n", n);
+  for(int i = 0; i < n; i++)
+    printf("  %d (pri %d) -> lock %d -> %d (pri %d)\n",
+           edges[i].waiter, edges[i].waiter_priority, edges[i].lock,
+           edges[i].holder, edges[i].holder_priority);
+}
+
+int
+main(void)
+{
+  int status, deadlocks = 0;
+
+  if(fork() == 0)
+    locker(0, 1, 10);
+  if(fork() == 0)
+    locker(1, 0, 20);
+
+  // The first child is now blocked on lock 1 behind the second.
+  pause(15);
+  dumpgraph();
+
+  for(int i = 0; i < 2; i++) {
+    wait(&status);
+    if(status == 2)
+      deadlocks++;
+    else if(status != 0) {
+      printf("pi_deadlock: FAILED (child status %d)\n", status);
+      exit(1);
+    }
+  }
+
+  if(deadlocks != 1) {
+    printf("pi_deadlock: FAILED (%d deadlocks reported)\n", deadlocks);
+    exit(1);
+  }
+  printf("pi_deadlock: OK\n");
+  exit(0);
+}
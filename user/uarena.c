@@ -0,0 +1,132 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+// Arenas, for memory that is all freed at once.
+//
+// arena_alloc() hands out memory from the arena's newest chunk
+// by moving a pointer, and arena_reset() or arena_destroy() free
+// everything the arena handed out in one go. Chunks come from
+// sbrk(); since the heap rarely shrinks, freed chunks go to a
+// pool that later arenas take from first.
+
+#define PGSIZE 4096
+#define CHUNK  (16*PGSIZE)  // usual chunk size
+
+struct chunk {
+  struct chunk *next;
+  uint64 size;           // bytes, including this header
+};
+
+struct arena {
+  struct chunk *chunks;  // newest first
+  char *cur;             // free space in the newest chunk
+  char *end;
+  struct arenastats st;
+};
+
+static struct chunk *pool;
+
+// Return a chunk of at least size bytes.
+static struct chunk*
+chunkalloc(uint64 size)
+{
+  struct chunk **pp, *c;
+
+  for(pp = &pool; (c = *pp) != 0; pp = &c->next){
+    if(c->size >= size){
+      *pp = c->next;
+      return c;
+    }
+  }
+  if(size < CHUNK)
+    size = CHUNK;
+  // whole pages, so that the break stays aligned for
+  // the next chunk's header.
+  size = (size + PGSIZE - 1) & ~((uint64)PGSIZE - 1);
+  if(size > 0x7fffffff || (c = (struct chunk*)sbrk(size)) == (struct chunk*)SBRK_ERROR)
+    return 0;
+  c->size = size;
+  return c;
+}
+
+struct arena*
+arena_create(void)
+{
+  struct arena *a;
+
+  if((a = malloc(sizeof(*a))) == 0)
+    return 0;
+  memset(a, 0, sizeof(*a));
+  return a;
+}
+
+// Allocate n bytes aligned to align, which must be a power
+// of two, or 0 for the 16 bytes malloc() guarantees.
+void*
+arena_alloc(struct arena *a, uint n, uint align)
+{
+  struct chunk *c;
+  char *p;
+
+  if(align == 0)
+    align = 16;
+  if(align & (align - 1))
+    return 0;
+  p = (char*)(((uint64)a->cur + align - 1) & ~((uint64)align - 1));
+  if(a->cur == 0 || p + n > a->end){
+    if((c = chunkalloc(sizeof(struct chunk) + align + n)) == 0)
+      return 0;
+    c->next = a->chunks;
+    a->chunks = c;
+    a->cur = (char*)(c + 1);
+    a->end = (char*)c + c->size;
+    a->st.size += c->size;
+    p = (char*)(((uint64)a->cur + align - 1) & ~((uint64)align - 1));
+  }
+  a->st.used += p + n - a->cur;
+  a->st.nalloc++;
+  a->cur = p + n;
+  return p;
+}
+
+// Free everything allocated from a, keeping its newest
+// chunk for the allocations to come.
+void
+arena_reset(struct arena *a)
+{
+  struct chunk *c, *next;
+
+  if((c = a->chunks) == 0)
+    return;
+  for(next = c->next; next; next = c->next){
+    c->next = next->next;
+    a->st.size -= next->size;
+    next->next = pool;
+    pool = next;
+  }
+  a->cur = (char*)(c + 1);
+  a->end = (char*)c + c->size;
+  a->st.used = 0;
+  a->st.nalloc = 0;
+}
+
+// Free everything allocated from a, and a itself.
+void
+arena_destroy(struct arena *a)
+{
+  struct chunk *c;
+
+  while((c = a->chunks) != 0){
+    a->chunks = c->next;
+    c->next = pool;
+    pool = c;
+  }
+  free(a);
+}
+
+void
+arena_stat(struct arena *a, struct arenastats *st)
+{
+  *st = a->st;
+}
@@ -3,6 +3,7 @@
 #include "kernel/fcntl.h"
 #include "kernel/riscv.h"
 #include "kernel/vm.h"
+#include "kernel/memlayout.h"
 #include "user/user.h"
 
 //
@@ -46,14 +47,28 @@ strlen(const char *s)
   return n;
 }
 
+// memset(), memmove() and memcmp() work a word at a time once
+// dst (and src) are word-aligned, as in the kernel's string.c.
+
+#define WMASK (sizeof(uint64) - 1)
+
 void*
 memset(void *dst, int c, uint n)
 {
-  char *cdst = (char *) dst;
-  int i;
-  for(i = 0; i < n; i++){
-    cdst[i] = c;
+  char *d = dst;
+  uint64 w, *wd;
+
+  for(; n > 0 && ((uint64)d & WMASK); n--)
+    *d++ = c;
+  w = (uchar)c * 0x0101010101010101ULL;
+  for(wd = (uint64*)d; n >= 8*sizeof(uint64); n -= 8*sizeof(uint64), wd += 8){
+    wd[0] = w; wd[1] = w; wd[2] = w; wd[3] = w;
+    wd[4] = w; wd[5] = w; wd[6] = w; wd[7] = w;
   }
+  for(; n >= sizeof(uint64); n -= sizeof(uint64))
+    *wd++ = w;
+  for(d = (char*)wd; n > 0; n--)
+    *d++ = c;
   return dst;
 }
 
@@ -114,15 +129,49 @@ memmove(void *vdst, const void *vsrc, int n)
 {
   char *dst;
   const char *src;
+  const uint64 *ws;
+  uint64 *wd;
 
+  if(n <= 0)
+    return vdst;
   dst = vdst;
   src = vsrc;
   if (src > dst) {
+    if((((uint64)src ^ (uint64)dst) & WMASK) == 0){
+      for(; n > 0 && ((uint64)dst & WMASK); n--)
+        *dst++ = *src++;
+      ws = (const uint64*)src;
+      wd = (uint64*)dst;
+      for(; n >= 8*sizeof(uint64); n -= 8*sizeof(uint64), ws += 8, wd += 8){
+        wd[0] = ws[0]; wd[1] = ws[1]; wd[2] = ws[2]; wd[3] = ws[3];
+        wd[4] = ws[4]; wd[5] = ws[5]; wd[6] = ws[6]; wd[7] = ws[7];
+      }
+      for(; n >= sizeof(uint64); n -= sizeof(uint64))
+        *wd++ = *ws++;
+      src = (const char*)ws;
+      dst = (char*)wd;
+    }
     while(n-- > 0)
       *dst++ = *src++;
   } else {
     dst += n;
     src += n;
+    if((((uint64)src ^ (uint64)dst) & WMASK) == 0){
+      for(; n > 0 && ((uint64)dst & WMASK); n--)
+        *--dst = *--src;
+      ws = (const uint64*)src;
+      wd = (uint64*)dst;
+      for(; n >= 8*sizeof(uint64); n -= 8*sizeof(uint64)){
+        ws -= 8;
+        wd -= 8;
+        wd[7] = ws[7]; wd[6] = ws[6]; wd[5] = ws[5]; wd[4] = ws[4];
+        wd[3] = ws[3]; wd[2] = ws[2]; wd[1] = ws[1]; wd[0] = ws[0];
+      }
+      for(; n >= sizeof(uint64); n -= sizeof(uint64))
+        *--wd = *--ws;
+      src = (const char*)ws;
+      dst = (char*)wd;
+    }
     while(n-- > 0)
       *--dst = *--src;
   }
@@ -132,7 +181,16 @@ memmove(void *vdst, const void *vsrc, int n)
 int
 memcmp(const void *s1, const void *s2, uint n)
 {
-  const char *p1 = s1, *p2 = s2;
+  const uchar *p1 = s1, *p2 = s2;
+
+  if((((uint64)p1 ^ (uint64)p2) & WMASK) == 0){
+    for(; n > 0 && ((uint64)p1 & WMASK); n--, p1++, p2++)
+      if(*p1 != *p2)
+        return *p1 - *p2;
+    // skip equal words; the loop below finds the differing byte.
+    for(; n >= sizeof(uint64) && *(uint64*)p1 == *(uint64*)p2; n -= sizeof(uint64))
+      p1 += sizeof(uint64), p2 += sizeof(uint64);
+  }
   while (n-- > 0) {
     if (*p1 != *p2) {
       return *p1 - *p2;
@@ -159,3 +217,30 @@ sbrklazy(int n) {
   return sys_sbrk(n, SBRK_LAZY);
 }
 
+// These read the pages the kernel maps read-only at USYSCALL
+// and UTIME (see memlayout.h) instead of trapping into the kernel.
+// The sys_ versions are the real system calls.
+
+int
+getpid(void)
+{
+  return ((volatile struct usyscall *)USYSCALL)->pid;
+}
+
+int
+getpriority(void)
+{
+  return ((volatile struct usyscall *)USYSCALL)->priority;
+}
+
+int
+uptime(void)
+{
+  return ((volatile struct utime *)UTIME)->ticks;
+}
+
+uint64
+uptime_ns(void)
+{
+  return r_time() * (1000000000L / ((volatile struct utime *)UTIME)->timebase);
+}
@@ -2,89 +2,236 @@
 #include "kernel/stat.h"
 #include "user/user.h"
 #include "kernel/param.h"
+#include "kernel/mman.h"
 
-// Memory allocator by Kernighan and Ritchie,
-// The C programming Language, 2nd ed.  Section 8.7.
+// Memory allocator with segregated size classes.
+//
+// Requests of up to MAXSMALL bytes are rounded up to one of
+// NCLASS size classes. Each class carves its objects out of
+// pages of its own with a bump pointer, and keeps freed objects
+// on a list for reuse, so small malloc() and free() take
+// constant time. Larger requests get whole pages, either from
+// a first-fit list of free page runs that merges neighbours
+// (Kernighan & Ritchie's scheme, in units of pages) grown by
+// sbrk(), or, from MMAPMIN up, straight from mmap().
+//
+// Every page malloc() hands out begins with a struct page,
+// so free() finds out how to free a pointer by rounding it
+// down to its page.
 
-typedef long Align;
+#define PGSIZE   4096
+#define NCLASS   12
+#define MAXSMALL 1024
+#define MMAPMIN  (64*PGSIZE)
+#define MORE     16       // fewest pages to ask sbrk() for
 
-union header {
-  struct {
-    union header *ptr;
-    uint size;
-  } s;
-  Align x;
+static ushort classsize[NCLASS] = {
+  16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024
 };
 
-typedef union header Header;
+enum { SLAB = 0x51ab, RUN, FREERUN, MAPPED };
 
-static Header base;
-static Header *freep;
+struct page {
+  ushort kind;
+  ushort class;         // SLAB: index into classsize[]
+  uint npages;          // RUN, FREERUN, MAPPED: pages in the block
+  struct page *next;    // FREERUN: next free run, by address
+};
 
-void
-free(void *ap)
+struct object {
+  struct object *next;
+};
+
+static struct {
+  struct object *free;  // freed objects of this class
+  char *bump;           // unused space in its newest page
+  char *end;
+} bins[NCLASS];
+
+static struct page *runs;  // free page runs, in address order
+static struct mallocstats stats;
+
+// Return a free run of pages to the list,
+// merging it with free neighbours.
+static void
+runfree(struct page *pg)
 {
-  Header *bp, *p;
-
-  bp = (Header*)ap - 1;
-  for(p = freep; !(bp > p && bp < p->s.ptr); p = p->s.ptr)
-    if(p >= p->s.ptr && (bp > p || bp < p->s.ptr))
-      break;
-  if(bp + bp->s.size == p->s.ptr){
-    bp->s.size += p->s.ptr->s.size;
-    bp->s.ptr = p->s.ptr->s.ptr;
-  } else
-    bp->s.ptr = p->s.ptr;
-  if(p + p->s.size == bp){
-    p->s.size += bp->s.size;
-    p->s.ptr = bp->s.ptr;
-  } else
-    p->s.ptr = bp;
-  freep = p;
+  struct page *prev = 0, *p;
+
+  pg->kind = FREERUN;
+  for(p = runs; p && p < pg; p = p->next)
+    prev = p;
+  if(p && (char*)pg + pg->npages*PGSIZE == (char*)p){
+    pg->npages += p->npages;
+    pg->next = p->next;
+  } else {
+    pg->next = p;
+  }
+  if(prev && (char*)prev + prev->npages*PGSIZE == (char*)pg){
+    prev->npages += pg->npages;
+    prev->next = pg->next;
+  } else if(prev){
+    prev->next = pg;
+  } else {
+    runs = pg;
+  }
 }
 
-static Header*
-morecore(uint nu)
+// Grow the heap by at least npages pages, page-aligned.
+static int
+morepages(uint npages)
 {
   char *p;
-  Header *hp;
-
-  if(nu < 4096)
-    nu = 4096;
-  p = sbrk(nu * sizeof(Header));
-  if(p == SBRK_ERROR)
-    return 0;
-  hp = (Header*)p;
-  hp->s.size = nu;
-  free((void*)(hp + 1));
-  return freep;
+  uint64 pad;
+  uint n = npages < MORE ? MORE : npages;
+  struct page *pg;
+
+  p = sbrk(0);
+  pad = -(uint64)p & (PGSIZE-1);
+  if(sbrk(pad + n*PGSIZE) == SBRK_ERROR){
+    // memory is short; ask for no more than needed.
+    n = npages;
+    if(sbrk(pad + n*PGSIZE) == SBRK_ERROR)
+      return -1;
+  }
+  stats.heap += pad + n*PGSIZE;
+  pg = (struct page*)(p + pad);
+  pg->npages = n;
+  runfree(pg);
+  return 0;
 }
 
-void*
-malloc(uint nbytes)
+// Allocate a run of npages pages.
+static struct page*
+runalloc(uint npages)
 {
-  Header *p, *prevp;
-  uint nunits;
+  struct page *prev, *p, *rest;
 
-  nunits = (nbytes + sizeof(Header) - 1)/sizeof(Header) + 1;
-  if((prevp = freep) == 0){
-    base.s.ptr = freep = prevp = &base;
-    base.s.size = 0;
-  }
-  for(p = prevp->s.ptr; ; prevp = p, p = p->s.ptr){
-    if(p->s.size >= nunits){
-      if(p->s.size == nunits)
-        prevp->s.ptr = p->s.ptr;
-      else {
-        p->s.size -= nunits;
-        p += p->s.size;
-        p->s.size = nunits;
+  for(;;){
+    prev = 0;
+    for(p = runs; p; prev = p, p = p->next){
+      if(p->npages < npages)
+        continue;
+      if(p->npages > npages){
+        rest = (struct page*)((char*)p + npages*PGSIZE);
+        rest->kind = FREERUN;
+        rest->npages = p->npages - npages;
+        rest->next = p->next;
+      } else {
+        rest = p->next;
       }
-      freep = prevp;
-      return (void*)(p + 1);
+      if(prev)
+        prev->next = rest;
+      else
+        runs = rest;
+      p->kind = RUN;
+      p->npages = npages;
+      return p;
     }
-    if(p == freep)
-      if((p = morecore(nunits)) == 0)
+    if(morepages(npages) < 0)
+      return 0;
+  }
+}
+
+static void*
+smalloc(uint nbytes)
+{
+  int c;
+  struct object *o;
+  struct page *pg;
+
+  for(c = 0; classsize[c] < nbytes; c++)
+    ;
+  if((o = bins[c].free) != 0){
+    bins[c].free = o->next;
+  } else {
+    if(bins[c].bump + classsize[c] > bins[c].end){
+      if((pg = runalloc(1)) == 0)
         return 0;
+      pg->kind = SLAB;
+      pg->class = c;
+      bins[c].bump = (char*)(pg + 1);
+      bins[c].end = (char*)pg + PGSIZE;
+    }
+    o = (struct object*)bins[c].bump;
+    bins[c].bump += classsize[c];
   }
+  stats.small += classsize[c];
+  return o;
+}
+
+static void*
+lmalloc(uint nbytes)
+{
+  uint npages = (nbytes + sizeof(struct page) + PGSIZE - 1) / PGSIZE;
+  struct page *pg;
+
+  pg = MAP_FAILED;
+  if(npages*PGSIZE >= MMAPMIN)
+    pg = mmap(0, npages*PGSIZE, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANON, -1, 0);
+  if(pg != MAP_FAILED){
+    pg->kind = MAPPED;
+    stats.mapped += npages*PGSIZE;
+  } else {
+    if((pg = runalloc(npages)) == 0)
+      return 0;
+  }
+  pg->npages = npages;
+  stats.large += npages*PGSIZE;
+  return pg + 1;
+}
+
+void*
+malloc(uint nbytes)
+{
+  void *p;
+
+  if(nbytes == 0)
+    nbytes = 1;
+  if(nbytes <= MAXSMALL)
+    p = smalloc(nbytes);
+  else
+    p = lmalloc(nbytes);
+  if(p)
+    stats.nmalloc++;
+  return p;
+}
+
+void
+free(void *ap)
+{
+  struct page *pg;
+  struct object *o;
+
+  if(ap == 0)
+    return;
+  pg = (struct page*)((uint64)ap & ~(PGSIZE-1));
+  stats.nfree++;
+  switch(pg->kind){
+  case SLAB:
+    o = ap;
+    o->next = bins[pg->class].free;
+    bins[pg->class].free = o;
+    stats.small -= classsize[pg->class];
+    break;
+  case RUN:
+    stats.large -= pg->npages*PGSIZE;
+    runfree(pg);
+    break;
+  case MAPPED:
+    stats.large -= pg->npages*PGSIZE;
+    stats.mapped -= pg->npages*PGSIZE;
+    munmap(pg, pg->npages*PGSIZE);
+    break;
+  default:
+    fprintf(2, "free: bad pointer %p\n", ap);
+    stats.nfree--;
+  }
+}
+
+// Copy out malloc()'s statistics.
+void
+mallocstat(struct mallocstats *st)
+{
+  *st = stats;
 }
@@ -1,6 +1,11 @@
 #define SBRK_ERROR ((char *)-1)
+#define MAP_FAILED ((void *)-1)
 
 struct stat;
+struct pi_edge;
+struct memstat;
+struct pollfd;
+struct ring;
 
 // system calls
 int fork(void);
@@ -8,7 +13,7 @@ int exit(int) __attribute__((noreturn));
 // ADD THESE LINES:
 int sleep(int);
 int setpriority(int);
-int getpriority(void);
+int sys_getpriority(void);
 int wait(int*);
 int pipe(int*);
 int write(int, const void*, int);
@@ -24,13 +29,30 @@ int link(const char*, const char*);
 int mkdir(const char*);
 int chdir(const char*);
 int dup(int);
-int getpid(void);
+int sys_getpid(void);
 char* sys_sbrk(int,int);
 int pause(int);
-int uptime(void);
+int sys_uptime(void);
 int test_acquire(void);
 int test_release(void);
 int cpu_work(int);
+int pi_acquire(int);
+int pi_release(int);
+int pi_graph(struct pi_edge*, int);
+uint64 sys_uptime_ns(void);
+int memstat(struct memstat*);
+void* mmap(void*, uint64, int, int, int, uint);
+int munmap(void*, uint64);
+int shmget(int, uint64);
+void* shmat(int);
+int shmdt(void*);
+int shmrm(int);
+int memlimit(int);
+int fcntl(int, int, int);
+int splice(int, int, int);
+int poll(struct pollfd*, int, int);
+struct ring* ringsetup(void);
+int ringenter(int);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -46,11 +68,37 @@ int memcmp(const void *, const void *, uint);
 void *memcpy(void *, const void *, uint);
 char* sbrk(int);
 char* sbrklazy(int);
+int getpid(void);
+int getpriority(void);
+int uptime(void);
+uint64 uptime_ns(void);
 
 // printf.c
 void fprintf(int, const char*, ...) __attribute__ ((format (printf, 2, 3)));
 void printf(const char*, ...) __attribute__ ((format (printf, 1, 2)));
 
 // umalloc.c
+struct mallocstats {
+  uint64 nmalloc;   // successful malloc() calls
+  uint64 nfree;     // free() calls
+  uint64 small;     // bytes in use in size-class objects
+  uint64 large;     // bytes in use in whole-page blocks
+  uint64 mapped;    // of those, bytes from mmap()
+  uint64 heap;      // bytes taken from sbrk()
+};
 void* malloc(uint);
 void free(void*);
+void mallocstat(struct mallocstats*);
+
+// uarena.c
+struct arena;
+struct arenastats {
+  uint64 nalloc;    // arena_alloc() calls since the last reset
+  uint64 used;      // bytes they took, alignment included
+  uint64 size;      // bytes of chunks the arena holds
+};
+struct arena* arena_create(void);
+void* arena_alloc(struct arena*, uint, uint);
+void arena_reset(struct arena*);
+void arena_destroy(struct arena*);
+void arena_stat(struct arena*, struct arenastats*);
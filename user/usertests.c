@@ -7,6 +7,10 @@
 #include "kernel/syscall.h"
 #include "kernel/memlayout.h"
 #include "kernel/riscv.h"
+#include "kernel/memstat.h"
+#include "kernel/mman.h"
+#include "kernel/poll.h"
+#include "kernel/ring.h"
 
 //
 // Tests xv6 system calls.  usertests without arguments runs them all
@@ -2713,7 +2717,7 @@ lazy_sbrk(char *s)
     p = sbrklazy(0);
   }
 
-  int n = TRAPFRAME-PGSIZE-(uint64)p;
+  int n = USERTOP-PGSIZE-(uint64)p;
 
   char *p1 = sbrklazy(n);
   if (p1 < 0 || p1 != p) {
@@ -2722,8 +2726,8 @@ lazy_sbrk(char *s)
   }
 
   p = sbrk(PGSIZE);
-  if (p < 0 || (uint64)p != TRAPFRAME-PGSIZE) {
-    printf("sbrk(%d) returned %p, not expected TRAPFRAME-PGSIZE\n", PGSIZE, p);
+  if (p < 0 || (uint64)p != USERTOP-PGSIZE) {
+    printf("sbrk(%d) returned %p, not expected USERTOP-PGSIZE\n", PGSIZE, p);
     exit(1);
   }
 
@@ -2748,6 +2752,1183 @@ lazy_sbrk(char *s)
   exit(0);
 }
 
+// uptime() and uptime_ns() read the clock without locks;
+// check that they are monotonic and roughly agree.
+void
+uptimens(char *s)
+{
+  uint64 t0, t1;
+  int u0, u1;
+
+  t0 = uptime_ns();
+  for(int i = 0; i < 1000; i++){
+    t1 = uptime_ns();
+    if(t1 < t0){
+      printf("%s: uptime_ns went backwards\n", s);
+      exit(1);
+    }
+    t0 = t1;
+  }
+
+  u0 = uptime();
+  t0 = uptime_ns();
+  pause(2);
+  u1 = uptime();
+  t1 = uptime_ns();
+  if(u1 - u0 < 2){
+    printf("%s: pause(2) took %d ticks\n", s, u1 - u0);
+    exit(1);
+  }
+  // a tick is about 100ms.
+  if(t1 - t0 < 100000000L){
+    printf("%s: pause(2) took only %lu ns\n", s, t1 - t0);
+    exit(1);
+  }
+}
+
+// getpid(), getpriority() and uptime() read the USYSCALL and
+// UTIME pages; check that they agree with the system calls,
+// and that user code cannot write those pages.
+void
+usyscall(char *s)
+{
+  int pid, xstatus;
+
+  if(getpid() != sys_getpid()){
+    printf("%s: getpid() %d != sys_getpid() %d\n", s, getpid(), sys_getpid());
+    exit(1);
+  }
+  if(sys_uptime() - uptime() > 1){
+    printf("%s: uptime() lags sys_uptime()\n", s);
+    exit(1);
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    if(getpid() != sys_getpid())
+      exit(1);
+    setpriority(3);
+    if(getpriority() != 3 || sys_getpriority() != 3)
+      exit(1);
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: child saw stale USYSCALL page\n", s);
+    exit(1);
+  }
+
+  pid = fork();
+  if(pid == 0){
+    ((struct usyscall *)USYSCALL)->pid = 0;
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != -1){
+    printf("%s: write to USYSCALL page succeeded\n", s);
+    exit(1);
+  }
+}
+
+// fork() shares memory copy-on-write: a process using more than
+// half of free memory can still fork, and parent and child
+// each see only their own writes.
+void
+cowfork(char *s)
+{
+  struct memstat st;
+  uint64 n, i;
+  char *a;
+  int pid, xstatus;
+
+  if(memstat(&st) < 0){
+    printf("%s: memstat failed\n", s);
+    exit(1);
+  }
+  n = st.nfree * 2 / 3 * PGSIZE;
+  a = sbrk(n);
+  if(a == SBRK_ERROR){
+    printf("%s: sbrk(%lu) failed\n", s, n);
+    exit(1);
+  }
+  for(i = 0; i < n; i += PGSIZE)
+    a[i] = 1;
+
+  for(int k = 0; k < 3; k++){
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      for(i = 0; i < n; i += 64*PGSIZE){
+        if(a[i] != 1)
+          exit(1);
+        a[i] = 2;
+      }
+      exit(0);
+    }
+    wait(&xstatus);
+    if(xstatus != 0){
+      printf("%s: child saw wrong data\n", s);
+      exit(1);
+    }
+  }
+  for(i = 0; i < n; i += PGSIZE){
+    if(a[i] != 1){
+      printf("%s: parent saw child's write\n", s);
+      exit(1);
+    }
+  }
+  sbrk(-n);
+}
+
+// mmap() of files, private and shared, and of anonymous memory.
+void
+mmaptest(char *s)
+{
+  char *f = "mmapfile";
+  char *a, *b;
+  int fd, i, pid, xstatus;
+
+  unlink(f);
+  fd = open(f, O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: open %s failed\n", s, f);
+    exit(1);
+  }
+  for(i = 0; i < 5000; i++)
+    buf[i] = 'a' + i % 26;
+  if(write(fd, buf, 5000) != 5000){
+    printf("%s: write %s failed\n", s, f);
+    exit(1);
+  }
+
+  // private: file contents, zeroes past EOF, writes stay private.
+  a = mmap(0, 3*PGSIZE, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if(a == MAP_FAILED){
+    printf("%s: mmap private failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 3*PGSIZE; i++){
+    char want = i < 5000 ? 'a' + i % 26 : 0;
+    if(a[i] != want){
+      printf("%s: mmap private byte %d is %d\n", s, i, a[i]);
+      exit(1);
+    }
+  }
+  a[0] = 'X';
+
+  // shared: writes reach the file on munmap().
+  b = mmap(0, PGSIZE, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if(b == MAP_FAILED){
+    printf("%s: mmap shared failed\n", s);
+    exit(1);
+  }
+  if(b[0] != 'a'){
+    printf("%s: private write leaked into shared mapping\n", s);
+    exit(1);
+  }
+  b[1] = 'Y';
+  if(munmap(b, PGSIZE) < 0 || munmap(a, 3*PGSIZE) < 0){
+    printf("%s: munmap failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  fd = open(f, O_RDONLY);
+  if(read(fd, buf, 2) != 2 || buf[0] != 'a' || buf[1] != 'Y'){
+    printf("%s: shared write did not reach the file\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink(f);
+
+  // anonymous shared memory is shared with children.
+  a = mmap(0, 2*PGSIZE, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANON, -1, 0);
+  if(a == MAP_FAILED){
+    printf("%s: mmap anon failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    a[PGSIZE] = 42;
+    exit(0);
+  }
+  wait(&xstatus);
+  if(a[0] != 0 || a[PGSIZE] != 42){
+    printf("%s: child's write to shared memory not seen\n", s);
+    exit(1);
+  }
+
+  // a child touching unmapped memory is killed.
+  munmap(a, 2*PGSIZE);
+  pid = fork();
+  if(pid == 0){
+    a[0] = 1;
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != -1){
+    printf("%s: write to unmapped memory succeeded\n", s);
+    exit(1);
+  }
+}
+
+// shared memory segments: attachments of one key share pages,
+// and the segment goes away with its last detach.
+void
+shmtest(char *s)
+{
+  int key = 0x5eed, id, pid, xstatus;
+  char *a, *b;
+
+  if((id = shmget(key, 2*PGSIZE)) < 0){
+    printf("%s: shmget failed\n", s);
+    exit(1);
+  }
+  if((a = shmat(id)) == MAP_FAILED){
+    printf("%s: shmat failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    if(shmget(key, PGSIZE) != id || (b = shmat(id)) == MAP_FAILED || b == a)
+      exit(1);
+    b[PGSIZE+1] = 'x';
+    shmdt(b);
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0 || a[PGSIZE+1] != 'x'){
+    printf("%s: child's write not seen\n", s);
+    exit(1);
+  }
+  if(shmrm(id) < 0 || shmrm(id) != -1){
+    printf("%s: shmrm failed\n", s);
+    exit(1);
+  }
+  if(shmdt(a) < 0){
+    printf("%s: shmdt failed\n", s);
+    exit(1);
+  }
+
+  // the last detach freed the removed segment; key now names a new one.
+  if((id = shmget(key, 2*PGSIZE)) < 0 || (a = shmat(id)) == MAP_FAILED){
+    printf("%s: shmget/shmat failed\n", s);
+    exit(1);
+  }
+  if(a[PGSIZE+1] != 0){
+    printf("%s: new segment not zeroed\n", s);
+    exit(1);
+  }
+  shmdt(a);
+  shmrm(id);
+}
+
+// segments that are created but never attached go away
+// with their creator.
+void
+shmabandon(char *s)
+{
+  struct memstat before, after;
+  int i, pid, xstatus;
+
+  if(memstat(&before) < 0){
+    printf("%s: memstat failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    for(i = 0; i < NSHM; i++)
+      if(shmget(0x5ee0 + i, SHMPAGES*PGSIZE) < 0)
+        exit(1);
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: could not create %d segments\n", s, NSHM);
+    exit(1);
+  }
+  memstat(&after);
+  if(after.nfree + 16 < before.nfree){
+    printf("%s: lost %ld pages\n", s, before.nfree - after.nfree);
+    exit(1);
+  }
+
+  // and their slots can be used again.
+  for(i = 0; i < NSHM; i++){
+    if(shmget(0x5ee0 + i, PGSIZE) < 0){
+      printf("%s: segment table full\n", s);
+      exit(1);
+    }
+  }
+  for(i = 0; i < NSHM; i++)
+    shmrm(shmget(0x5ee0 + i, PGSIZE));
+}
+
+// free pages in buddy blocks big enough for a megapage.
+static uint64
+megafree(void)
+{
+  struct memstat st;
+  uint64 n = 0;
+  int k;
+
+  memstat(&st);
+  for(k = SUPERPGORDER; k <= MAXORDER; k++)
+    n += st.nblocks[k] << k;
+  return n;
+}
+
+// eager sbrk() of aligned 2MB ranges gets megapages; check that
+// they survive shrinking to a point inside them, and fork().
+void
+superpage(char *s)
+{
+  uint64 mb2 = SUPERPGSIZE, top, n, i, big0, big1;
+  struct memstat st0, st1;
+  char *old, *a;
+  int pid, xstatus;
+
+  // grow to a 2MB boundary, then by three megapages.
+  old = sbrk(0);
+  top = ((uint64)old + mb2 - 1) & ~(mb2 - 1);
+  if(sbrk(top - (uint64)old) == SBRK_ERROR){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  big0 = megafree();
+  memstat(&st0);
+  if(sbrk(3*mb2) == SBRK_ERROR){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  memstat(&st1);
+  big1 = megafree();
+  // three 2MB blocks, and no level-0 page tables for them.
+  if(big0 < big1 + 3*(mb2/PGSIZE) ||
+     st0.nfree - st1.nfree >= 3*(mb2/PGSIZE) + 3){
+    printf("%s: sbrk did not map megapages\n", s);
+    exit(1);
+  }
+  a = (char*)top;
+  for(i = 0; i < 3*mb2; i += PGSIZE)
+    a[i] = i / PGSIZE;
+
+  // end in the middle of the second megapage.
+  n = mb2 + mb2/2;
+  sbrk(-(3*mb2 - n));
+  for(i = 0; i < n; i += PGSIZE){
+    if(a[i] != (char)(i / PGSIZE)){
+      printf("%s: lost data after shrinking\n", s);
+      exit(1);
+    }
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    for(i = 0; i < n; i += PGSIZE){
+      if(a[i] != (char)(i / PGSIZE))
+        exit(1);
+      a[i] = 0;
+    }
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: child saw wrong data\n", s);
+    exit(1);
+  }
+  for(i = 0; i < n; i += PGSIZE){
+    if(a[i] != (char)(i / PGSIZE)){
+      printf("%s: parent saw child's write\n", s);
+      exit(1);
+    }
+  }
+  sbrk(old - sbrk(0));
+}
+
+// reading untouched lazily-allocated memory maps the shared zero
+// page rather than allocating; writing then gets a private page.
+void
+zeropage(char *s)
+{
+  struct memstat st0, st1;
+  int npages = 256, sum = 0;
+  char *a;
+
+  if((a = sbrklazy(npages*PGSIZE)) == SBRK_ERROR){
+    printf("%s: sbrklazy failed\n", s);
+    exit(1);
+  }
+  memstat(&st0);
+  for(int i = 0; i < npages; i++)
+    sum += a[i*PGSIZE];
+  memstat(&st1);
+  if(sum != 0){
+    printf("%s: lazy memory not zero\n", s);
+    exit(1);
+  }
+  // allow for page-table pages and other processes.
+  if(st0.nfree - st1.nfree > npages/4){
+    printf("%s: reads allocated %lu pages\n", s, st0.nfree - st1.nfree);
+    exit(1);
+  }
+  for(int i = 0; i < npages; i++)
+    a[i*PGSIZE] = i;
+  for(int i = 0; i < npages; i++){
+    if(a[i*PGSIZE] != (char)i || a[i*PGSIZE+1] != 0){
+      printf("%s: wrong data after write\n", s);
+      exit(1);
+    }
+  }
+  sbrk(-npages*PGSIZE);
+}
+
+// memstat() reports the process's resident pages, and
+// memlimit() caps them for eager and lazy allocation alike.
+void
+rsslimit(char *s)
+{
+  struct memstat st0, st1;
+  int pid, xstatus;
+  char *a;
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    memstat(&st0);
+    if(sbrk(5*PGSIZE) == SBRK_ERROR)
+      exit(1);
+    memstat(&st1);
+    if(st1.rss != st0.rss + 5){
+      printf("%s: rss %lu after sbrk, want %lu\n", s, st1.rss, st0.rss + 5);
+      exit(1);
+    }
+    memlimit(st1.rss + 10);
+    if(sbrk(20*PGSIZE) != SBRK_ERROR){
+      printf("%s: sbrk past the limit succeeded\n", s);
+      exit(1);
+    }
+    if(sbrk(5*PGSIZE) == SBRK_ERROR){
+      printf("%s: sbrk within the limit failed\n", s);
+      exit(1);
+    }
+    // touching lazy memory past the limit kills the process.
+    a = sbrklazy(20*PGSIZE);
+    for(int i = 0; i < 20; i++)
+      a[i*PGSIZE] = 1;
+    exit(1);
+  }
+  wait(&xstatus);
+  if(xstatus != -1){
+    printf("%s: exceeded the limit (%d)\n", s, xstatus);
+    exit(1);
+  }
+}
+
+// a child cannot raise or remove the limit it inherited.
+void
+rsslimitchild(char *s)
+{
+  struct memstat st;
+  int pid, xstatus;
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    memstat(&st);
+    if(memlimit(st.rss + 100) != 0){
+      printf("%s: memlimit failed\n", s);
+      exit(1);
+    }
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      if(memlimit(0) != -1 || memlimit(st.rss + 101) != -1 ||
+         memlimit(st.rss + 100000) != -1){
+        printf("%s: child raised its limit\n", s);
+        exit(1);
+      }
+      memstat(&st);
+      if(st.rsslimit == 0){
+        printf("%s: child lost its limit\n", s);
+        exit(1);
+      }
+      if(memlimit(st.rsslimit - 1) != 0){
+        printf("%s: child could not lower its limit\n", s);
+        exit(1);
+      }
+      exit(0);
+    }
+    wait(&xstatus);
+    exit(xstatus);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(1);
+}
+
+// malloc() size classes reuse freed objects of the same class,
+// and large blocks are accounted for and given back on free().
+void
+mallocclass(char *s)
+{
+  struct mallocstats st0, st1;
+  char *a, *b, *p[64];
+  int i, j;
+
+  mallocstat(&st0);
+  a = malloc(40);
+  free(a);
+  if((b = malloc(33)) != a){
+    printf("%s: freed object of the same class not reused\n", s);
+    exit(1);
+  }
+  free(b);
+
+  for(i = 0; i < 64; i++){
+    if((p[i] = malloc(i*37 + 1)) == 0 || (uint64)p[i] % 16 != 0){
+      printf("%s: malloc(%d) failed or misaligned\n", s, i*37 + 1);
+      exit(1);
+    }
+    memset(p[i], i, i*37 + 1);
+  }
+  for(i = 0; i < 64; i++){
+    for(j = 0; j < i*37 + 1; j++){
+      if(p[i][j] != (char)i){
+        printf("%s: blocks overlap\n", s);
+        exit(1);
+      }
+    }
+    free(p[i]);
+  }
+
+  a = malloc(3*4096);
+  b = malloc(300*1024);
+  if(a == 0 || b == 0){
+    printf("%s: large malloc failed\n", s);
+    exit(1);
+  }
+  a[3*4096-1] = b[300*1024-1] = 1;
+  free(a);
+  free(b);
+  mallocstat(&st1);
+  if(st1.small != st0.small || st1.large != st0.large || st1.mapped != st0.mapped){
+    printf("%s: bytes in use did not return to where they started\n", s);
+    exit(1);
+  }
+  if(st1.nmalloc - st0.nmalloc != 68 || st1.nfree - st0.nfree != 68){
+    printf("%s: wrong malloc/free counts\n", s);
+    exit(1);
+  }
+}
+
+// arenas: aligned bump allocation, reset and destroy.
+void
+arenatest(char *s)
+{
+  struct arena *a;
+  struct arenastats st;
+  char *p, *q, *top;
+  int i;
+
+  if((a = arena_create()) == 0){
+    printf("%s: arena_create failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 1000; i++){
+    p = arena_alloc(a, 24 + i % 7, 1 << (i % 8));
+    if(p == 0 || (uint64)p % (1 << (i % 8)) != 0){
+      printf("%s: arena_alloc failed or misaligned\n", s);
+      exit(1);
+    }
+    memset(p, i, 24 + i % 7);
+  }
+  // bigger than a chunk.
+  if((q = arena_alloc(a, 100*1024, 64)) == 0){
+    printf("%s: big arena_alloc failed\n", s);
+    exit(1);
+  }
+  q[100*1024-1] = 1;
+  arena_stat(a, &st);
+  if(st.nalloc != 1001 || st.used < 100*1024 + 24*1000 || st.size < st.used){
+    printf("%s: bad stats\n", s);
+    exit(1);
+  }
+
+  arena_reset(a);
+  arena_stat(a, &st);
+  if(st.nalloc != 0 || st.used != 0){
+    printf("%s: reset did not clear stats\n", s);
+    exit(1);
+  }
+  // the newest chunk is kept, and allocation restarts at its start.
+  p = arena_alloc(a, 16, 0);
+  if(p == 0 || p > q){
+    printf("%s: reset did not reuse the newest chunk\n", s);
+    exit(1);
+  }
+  arena_destroy(a);
+
+  // destroyed chunks are reused by the next arena.
+  a = arena_create();
+  top = sbrk(0);
+  if(arena_alloc(a, 1, 0) == 0 || sbrk(0) != top){
+    printf("%s: freed chunk not reused\n", s);
+    exit(1);
+  }
+  arena_destroy(a);
+}
+
+// word-at-a-time memmove, memset and memcmp, against byte loops,
+// for every alignment and overlap of small buffers.
+void
+memops(char *s)
+{
+  static char buf[256], ref[256];
+  int d, o, n, i, j;
+
+  for(d = 0; d < 16; d++){
+    for(o = 0; o < 40; o++){
+      for(n = 0; n < 100; n += 7){
+        for(i = 0; i < sizeof(buf); i++)
+          buf[i] = ref[i] = i * 7;
+        memmove(buf + 64 + d, buf + 64 + o - 20, n);
+        if(64 + d < 64 + o - 20){
+          for(j = 0; j < n; j++)
+            ref[64 + d + j] = ref[64 + o - 20 + j];
+        } else {
+          for(j = n - 1; j >= 0; j--)
+            ref[64 + d + j] = ref[64 + o - 20 + j];
+        }
+        for(i = 0; i < sizeof(buf); i++){
+          if(buf[i] != ref[i]){
+            printf("%s: memmove(%d, %d, %d) wrong at %d\n", s, d, o - 20, n, i);
+            exit(1);
+          }
+        }
+
+        memset(buf + d, o, n);
+        for(j = 0; j < n; j++)
+          ref[d + j] = o;
+        if(memcmp(buf, ref, sizeof(buf)) != 0){
+          printf("%s: memset(%d, %d) wrong\n", s, d, n);
+          exit(1);
+        }
+        if(n > 0){
+          ref[d + n - 1]++;
+          if(memcmp(buf + d, ref + d, n) >= 0 || memcmp(ref + d, buf + d, n) <= 0){
+            printf("%s: memcmp(%d, %d) wrong\n", s, d, n);
+            exit(1);
+          }
+        }
+      }
+    }
+  }
+}
+
+// fcntl(F_GETPIPE_SZ) and fcntl(F_SETPIPE_SZ).
+void
+pipesize(char *s)
+{
+  int fds[2], i, n;
+  static char buf[32768];
+
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  if(fcntl(fds[0], F_GETPIPE_SZ, 0) != 4096){
+    printf("%s: default pipe size is not a page\n", s);
+    exit(1);
+  }
+  if(fcntl(fds[1], F_SETPIPE_SZ, 20000) != 32768 || fcntl(fds[0], F_GETPIPE_SZ, 0) != 32768){
+    printf("%s: could not grow pipe\n", s);
+    exit(1);
+  }
+  // the whole buffer fills without a reader.
+  for(i = 0; i < sizeof(buf); i++)
+    buf[i] = i % 251;
+  if(write(fds[1], buf, 1000) != 1000){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+  if(fcntl(fds[1], F_SETPIPE_SZ, 1) != 4096){
+    printf("%s: could not shrink pipe\n", s);
+    exit(1);
+  }
+  if(fcntl(fds[1], F_SETPIPE_SZ, 32768) != 32768){
+    printf("%s: could not grow pipe again\n", s);
+    exit(1);
+  }
+  if(write(fds[1], buf + 1000, sizeof(buf) - 1000) != sizeof(buf) - 1000){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+  if(fcntl(fds[1], F_SETPIPE_SZ, 4096) != -1){
+    printf("%s: shrank a pipe below its contents\n", s);
+    exit(1);
+  }
+  if(fcntl(fds[1], F_SETPIPE_SZ, 64*1024*1024) != -1){
+    printf("%s: grew a pipe past the limit\n", s);
+    exit(1);
+  }
+  memset(buf, 0, sizeof(buf));
+  for(i = 0; i < sizeof(buf); i += n){
+    if((n = read(fds[0], buf + i, sizeof(buf) - i)) <= 0){
+      printf("%s: read failed\n", s);
+      exit(1);
+    }
+  }
+  for(i = 0; i < sizeof(buf); i++){
+    if(buf[i] != (char)(i % 251)){
+      printf("%s: wrong data at %d\n", s, i);
+      exit(1);
+    }
+  }
+  close(fds[0]);
+  close(fds[1]);
+  if(fcntl(0, F_SETPIPE_SZ, 8192) != -1){
+    printf("%s: resized a non-pipe\n", s);
+    exit(1);
+  }
+}
+
+// splice() from a file to a pipe and from the pipe to a file.
+void
+splicetest(char *s)
+{
+  int fd, fds[2], i, n;
+  static char buf[3000];
+
+  for(i = 0; i < sizeof(buf); i++)
+    buf[i] = 'a' + i % 26;
+  fd = open("splicein", O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, buf, sizeof(buf)) != sizeof(buf)){
+    printf("%s: create splicein failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+
+  fd = open("splicein", O_RDONLY);
+  if((n = splice(fd, fds[1], 5000)) != sizeof(buf)){
+    printf("%s: splice from file moved %d\n", s, n);
+    exit(1);
+  }
+  if(splice(fd, fds[1], 10) != 0){
+    printf("%s: splice at end of file\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  fd = open("spliceout", O_CREATE|O_RDWR);
+  if(splice(fds[0], fd, 1000) != 1000 || splice(fds[0], fd, 5000) != 2000){
+    printf("%s: splice to file failed\n", s);
+    exit(1);
+  }
+  if(splice(fd, fd, 10) != -1){
+    printf("%s: spliced between two files\n", s);
+    exit(1);
+  }
+  close(fd);
+  close(fds[0]);
+  close(fds[1]);
+
+  memset(buf, 0, sizeof(buf));
+  fd = open("spliceout", O_RDONLY);
+  if(read(fd, buf, sizeof(buf)) != sizeof(buf)){
+    printf("%s: short spliceout\n", s);
+    exit(1);
+  }
+  close(fd);
+  for(i = 0; i < sizeof(buf); i++){
+    if(buf[i] != 'a' + i % 26){
+      printf("%s: wrong data at %d\n", s, i);
+      exit(1);
+    }
+  }
+  unlink("splicein");
+  unlink("spliceout");
+}
+
+// splice() from a file into a nonblocking pipe with less room
+// than asked for moves what fits and leaves the rest in the file.
+void
+splicefull(char *s)
+{
+  int fd, fds[2], i, n, size;
+  static char buf[4096];
+
+  for(i = 0; i < 3000; i++)
+    buf[i] = 'a' + i % 26;
+  fd = open("splicein", O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, buf, 3000) != 3000){
+    printf("%s: create splicein failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  if(fcntl(fds[1], F_SETFL, O_NONBLOCK) != 0 ||
+     (size = fcntl(fds[1], F_GETPIPE_SZ, 0)) < 1000){
+    printf("%s: fcntl failed\n", s);
+    exit(1);
+  }
+  // leave 1000 bytes free.
+  for(n = size - 1000; n > 0; n -= i){
+    i = n < sizeof(buf) ? n : sizeof(buf);
+    if(write(fds[1], buf, i) != i){
+      printf("%s: fill failed\n", s);
+      exit(1);
+    }
+  }
+
+  fd = open("splicein", O_RDONLY);
+  if((n = splice(fd, fds[1], 3000)) != 1000){
+    printf("%s: splice into full pipe moved %d\n", s, n);
+    exit(1);
+  }
+  if(splice(fd, fds[1], 3000) != -1){
+    printf("%s: splice into full pipe did not fail\n", s);
+    exit(1);
+  }
+  for(n = size - 1000; n > 0; n -= i){
+    i = n < sizeof(buf) ? n : sizeof(buf);
+    if(read(fds[0], buf, i) != i){
+      printf("%s: drain failed\n", s);
+      exit(1);
+    }
+  }
+  if(splice(fd, fds[1], 3000) != 2000){
+    printf("%s: second splice was short\n", s);
+    exit(1);
+  }
+  close(fd);
+  close(fds[1]);
+
+  if((n = read(fds[0], buf, sizeof(buf))) != 3000){
+    printf("%s: pipe held %d bytes\n", s, n);
+    exit(1);
+  }
+  close(fds[0]);
+  for(i = 0; i < 3000; i++){
+    if(buf[i] != 'a' + i % 26){
+      printf("%s: wrong data at %d\n", s, i);
+      exit(1);
+    }
+  }
+  unlink("splicein");
+}
+
+// splice() from a pipe consumes only what it wrote: into a
+// file at its maximum size, and into a nonblocking pipe that
+// fills up, the rest stays in the input pipe.
+void
+splicepipe(char *s)
+{
+  int fd, in[2], out[2], i, n, size;
+  static char buf[3000];
+
+  if(pipe(in) != 0 || pipe(out) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < sizeof(buf); i++)
+    buf[i] = 'a' + i % 26;
+  if(write(in[1], buf, sizeof(buf)) != sizeof(buf)){
+    printf("%s: write to pipe failed\n", s);
+    exit(1);
+  }
+
+  // a file with room for 1000 more bytes.
+  fd = open("spliceout", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create spliceout failed\n", s);
+    exit(1);
+  }
+  memset(buf, 'x', sizeof(buf));
+  for(n = MAXFILE*BSIZE - 1000; n > 0; n -= i){
+    i = n < sizeof(buf) ? n : sizeof(buf);
+    if(write(fd, buf, i) != i){
+      printf("%s: fill spliceout failed\n", s);
+      exit(1);
+    }
+  }
+  if(splice(in[0], fd, 3000) != -1){
+    printf("%s: splice past the end of a file succeeded\n", s);
+    exit(1);
+  }
+  if(splice(in[0], fd, 1000) != 1000){
+    printf("%s: splice to fill the file failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("spliceout");
+
+  // a pipe with room for 1000 bytes.
+  if(fcntl(out[1], F_SETFL, O_NONBLOCK) != 0 ||
+     (size = fcntl(out[1], F_GETPIPE_SZ, 0)) < 1000){
+    printf("%s: fcntl failed\n", s);
+    exit(1);
+  }
+  for(n = size - 1000; n > 0; n -= i){
+    i = n < sizeof(buf) ? n : sizeof(buf);
+    if(write(out[1], buf, i) != i){
+      printf("%s: fill pipe failed\n", s);
+      exit(1);
+    }
+  }
+  if(splice(in[0], out[1], 2000) != 1000){
+    printf("%s: splice into a filling pipe was not short\n", s);
+    exit(1);
+  }
+  if(splice(in[0], out[1], 2000) != -1){
+    printf("%s: splice into a full pipe succeeded\n", s);
+    exit(1);
+  }
+  close(out[0]);
+  close(out[1]);
+
+  close(in[1]);
+  if((n = read(in[0], buf, sizeof(buf))) != 1000){
+    printf("%s: input pipe held %d bytes, not 1000\n", s, n);
+    exit(1);
+  }
+  close(in[0]);
+  for(i = 0; i < 1000; i++){
+    if(buf[i] != 'a' + (2000 + i) % 26){
+      printf("%s: wrong data at %d\n", s, 2000 + i);
+      exit(1);
+    }
+  }
+}
+
+// O_NONBLOCK pipes and poll().
+void
+polltest(char *s)
+{
+  int a[2], b[2], pid, n, xstatus, t0;
+  struct pollfd pfd[3];
+  static char buf[8192];
+
+  if(pipe(a) != 0 || pipe(b) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  pfd[0].fd = a[0];
+  pfd[0].events = POLLIN;
+  pfd[1].fd = b[0];
+  pfd[1].events = POLLIN;
+  pfd[2].fd = -1;
+  if(poll(pfd, 3, 0) != 0 || pfd[0].revents || pfd[1].revents){
+    printf("%s: empty pipes polled ready\n", s);
+    exit(1);
+  }
+
+  // a writer in another process wakes poll().
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    pause(2);
+    write(b[1], "x", 1);
+    exit(0);
+  }
+  if(poll(pfd, 3, -1) != 1 || pfd[0].revents || pfd[1].revents != POLLIN){
+    printf("%s: poll did not see the write\n", s);
+    exit(1);
+  }
+  wait(&xstatus);
+  if(read(b[0], buf, 1) != 1){
+    printf("%s: read failed\n", s);
+    exit(1);
+  }
+
+  // timeouts.
+  t0 = uptime();
+  if(poll(pfd, 2, 250) != 0){
+    printf("%s: poll with timeout returned ready\n", s);
+    exit(1);
+  }
+  if(uptime() - t0 < 2){
+    printf("%s: poll returned before its timeout\n", s);
+    exit(1);
+  }
+
+  // non-blocking reads and writes.
+  if(fcntl(a[0], F_SETFL, O_NONBLOCK) != 0 || fcntl(a[1], F_SETFL, O_NONBLOCK) != 0 ||
+     fcntl(a[0], F_GETFL, 0) != (O_RDONLY|O_NONBLOCK)){
+    printf("%s: F_SETFL failed\n", s);
+    exit(1);
+  }
+  if(read(a[0], buf, 1) != -1){
+    printf("%s: non-blocking read of empty pipe\n", s);
+    exit(1);
+  }
+  n = fcntl(a[1], F_GETPIPE_SZ, 0);
+  if(write(a[1], buf, sizeof(buf)) != n || write(a[1], buf, 1) != -1){
+    printf("%s: non-blocking write of full pipe\n", s);
+    exit(1);
+  }
+  pfd[0].fd = a[1];
+  pfd[0].events = POLLOUT;
+  if(poll(pfd, 1, 0) != 0){
+    printf("%s: full pipe polled writable\n", s);
+    exit(1);
+  }
+  if(read(a[0], buf, sizeof(buf)) != n || poll(pfd, 1, 0) != 1 || pfd[0].revents != POLLOUT){
+    printf("%s: drained pipe not writable\n", s);
+    exit(1);
+  }
+
+  // hang-ups and closed fds.
+  close(b[1]);
+  pfd[0].fd = b[0];
+  pfd[0].events = POLLIN;
+  pfd[1].fd = b[1];
+  if(poll(pfd, 2, -1) != 2 || pfd[0].revents != (POLLIN|POLLHUP) || pfd[1].revents != POLLNVAL){
+    printf("%s: wrong hang-up or closed-fd bits\n", s);
+    exit(1);
+  }
+  close(a[0]);
+  close(a[1]);
+  close(b[0]);
+}
+
+// batched system calls through ringsetup() and ringenter().
+void
+ringtest(char *s)
+{
+  struct ring *r, *c;
+  int fds[2], i, pid, xstatus;
+  char buf[16], *a;
+
+  if((r = ringsetup()) == (struct ring*)-1 || ringsetup() != r){
+    printf("%s: ringsetup failed\n", s);
+    exit(1);
+  }
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  if(ringenter(RINGSIZE) != 0){
+    printf("%s: empty ring did something\n", s);
+    exit(1);
+  }
+
+  r->sq[0] = (struct ringsqe){ RING_WRITE, fds[1], (uint64)"hello", 5, 100 };
+  r->sq[1] = (struct ringsqe){ RING_READ, fds[0], (uint64)buf, sizeof(buf), 101 };
+  r->sq[2] = (struct ringsqe){ RING_NOP, 0, 0, 0, 102 };
+  r->sq[3] = (struct ringsqe){ RING_READ, NOFILE, (uint64)buf, 1, 103 };
+  r->sq[4] = (struct ringsqe){ RING_PI_ACQUIRE, 0, 0, 0, 104 };
+  r->sq[5] = (struct ringsqe){ RING_PI_RELEASE, 0, 0, 0, 105 };
+  r->sqtail = 6;
+  // a batch may stop short of the queue.
+  if(ringenter(2) != 2 || r->sqhead != 2 || ringenter(RINGSIZE) != 4){
+    printf("%s: ringenter did the wrong number\n", s);
+    exit(1);
+  }
+  if(r->sqhead != 6 || r->cqtail != 6){
+    printf("%s: rings not advanced\n", s);
+    exit(1);
+  }
+  int want[6] = { 5, 5, 0, -1, 0, 0 };
+  for(i = 0; i < 6; i++){
+    if(r->cq[i].data != 100 + i || r->cq[i].res != want[i]){
+      printf("%s: completion %d is %d, not %d\n", s, i, r->cq[i].res, want[i]);
+      exit(1);
+    }
+  }
+  if(memcmp(buf, "hello", 5) != 0){
+    printf("%s: ring read wrong data\n", s);
+    exit(1);
+  }
+
+  // a full completion ring stops submission.
+  r->cqhead = r->cqtail - RINGSIZE + 1;
+  for(i = 0; i < 3; i++)
+    r->sq[(r->sqtail + i) % RINGSIZE] = (struct ringsqe){ RING_NOP, 0, 0, 0, 0 };
+  r->sqtail += 3;
+  if(ringenter(RINGSIZE) != 1 || r->sqtail - r->sqhead != 2){
+    printf("%s: overran the completion ring\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+
+  // a child does not inherit the ring, and gets its own.
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    if(ringenter(RINGSIZE) != -1)
+      exit(1);
+    if((c = ringsetup()) == (struct ring*)-1 || c->sqhead != 0)
+      exit(1);
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0 || r->sqhead != r->sqtail - 2){
+    printf("%s: child shared the ring\n", s);
+    exit(1);
+  }
+
+  // unmapping the ring forgets it, even if the address is reused.
+  if(munmap(r, PGSIZE) != 0){
+    printf("%s: munmap failed\n", s);
+    exit(1);
+  }
+  if(ringenter(RINGSIZE) != -1){
+    printf("%s: ringenter after munmap\n", s);
+    exit(1);
+  }
+  a = mmap(0, PGSIZE, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANON, -1, 0);
+  if(a == MAP_FAILED || (c = ringsetup()) == (struct ring*)-1 || (char*)c == a){
+    printf("%s: ringsetup reused an unrelated mapping\n", s);
+    exit(1);
+  }
+}
+
 struct test {
   void (*f)(char *);
   char *s;
@@ -2816,6 +3997,25 @@ struct test {
   {lazy_unmap, "lazy_unmap"},
   {lazy_copy, "lazy_copy"},
   {lazy_sbrk, "lazy_sbrk"},
+  {uptimens, "uptimens"},
+  {usyscall, "usyscall"},
+  {cowfork, "cowfork"},
+  {mmaptest, "mmap"},
+  {shmtest, "shm"},
+  {shmabandon, "shmabandon"},
+  {superpage, "superpage"},
+  {zeropage, "zeropage"},
+  {rsslimit, "rsslimit"},
+  {rsslimitchild, "rsslimitchild"},
+  {mallocclass, "mallocclass"},
+  {arenatest, "arena"},
+  {memops, "memops"},
+  {pipesize, "pipesize"},
+  {splicetest, "splice"},
+  {splicefull, "splicefull"},
+  {splicepipe, "splicepipe"},
+  {polltest, "poll"},
+  {ringtest, "ring"},
   { 0, 0},
 };
 
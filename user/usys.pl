@@ -6,10 +6,14 @@ print "# generated by usys.pl - do not edit\n";
 
 print "#include \"kernel/syscall.h\"\n";
 
+# ulib.c wraps these: the stub is named sys_<name> and the
+# library provides <name> itself.
+my %wrapped = map { $_ => 1 } qw(sbrk getpid uptime getpriority uptime_ns);
+
 sub entry {
     my $prefix = "sys_";
     my $name = shift;
-    if ($name eq "sbrk") {
+    if ($wrapped{$name}) {
 	print ".global $prefix$name\n";
 	print "$prefix$name:\n";
     } else {
@@ -47,3 +51,20 @@ entry("getpriority");
 entry("test_acquire");
 entry("test_release");
 entry("cpu_work");
+entry("pi_acquire");
+entry("pi_release");
+entry("pi_graph");
+entry("uptime_ns");
+entry("memstat");
+entry("mmap");
+entry("munmap");
+entry("shmget");
+entry("shmat");
+entry("shmdt");
+entry("memlimit");
+entry("fcntl");
+entry("splice");
+entry("poll");
+entry("ringsetup");
+entry("ringenter");
+entry("shmrm");